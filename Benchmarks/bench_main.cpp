@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Message.h"
+#include "MessageCodec.h"
+#include "ContentFilter.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Command line options
+struct BenchConfig {
+    std::string suite;          // "codec" or "filter"
+    int iterations = 0;         // Calls per measured loop, 0 = the suite's default
+    int checks = 200000;        // filter: random strings compared per term set and kernel
+    unsigned seed = 1;          // filter: random input seed
+};
+
+void printUsage() {
+    printf("Usage: Benchmarks SUITE [options]\n");
+    printf("  codec               encode a 64-byte TEXT frame with MessageCodec and with the old\n");
+    printf("                      Buffer-based encoder; checks both give the same bytes and that\n");
+    printf("                      TryEncode refuses frames over MAX_PACKET_SIZE\n");
+    printf("  filter              compare every ContentFilter kernel this CPU runs with a plain\n");
+    printf("                      reference on random input, then time each on a 200-byte message\n");
+    printf("  --iterations N      calls per measured loop (default 5000000 codec, 2000000 filter)\n");
+    printf("  --checks N          filter: random strings per term set (default 200000)\n");
+    printf("  --seed N            filter: random input seed (default 1)\n");
+}
+
+// Returns false on an unknown option
+bool parseArgs(int argc, char** argv, BenchConfig& config) {
+    if (argc < 2) {
+        return false;
+    }
+    config.suite = argv[1];
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        }
+
+        if (arg == "--iterations") config.iterations = atoi(value);
+        else if (arg == "--checks") config.checks = atoi(value);
+        else if (arg == "--seed") config.seed = static_cast<unsigned>(strtoul(value, nullptr, 10));
+        else return false;
+
+        i++;
+    }
+
+    if (config.iterations == 0) {
+        config.iterations = config.suite == "filter" ? 2000000 : 5000000;
+    }
+
+    return config.iterations > 0 && config.checks >= 0 && (config.suite == "codec" || config.suite == "filter");
+}
+
+// Nanoseconds per call of 'fn' over 'iterations' calls
+template <typename Fn>
+double timePerCall(int iterations, Fn&& fn) {
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < iterations; i++) {
+        fn();
+    }
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+// ---------------------------------------------------------------------------------------
+// Codec: the encoder MessageCodec replaced, kept here only as the baseline. It copied the
+// fields into a ChatMessage, then wrote them byte by byte into a growable buffer.
+
+namespace legacy {
+    class Buffer {
+    public:
+        explicit Buffer(size_t size) : m_BufferData(size), m_Size(size), m_WriteIndex(0) { }
+
+        void EnsureCapacity(size_t size) {
+            if (m_WriteIndex + size > m_Size) {
+                m_Size = (std::max)(m_Size * 2, m_WriteIndex + size);
+                m_BufferData.resize(m_Size);
+            }
+        }
+
+        void WriteUInt32LE(uint32_t value) {
+            EnsureCapacity(sizeof(uint32_t));
+            m_BufferData[m_WriteIndex++] = value >> 24;
+            m_BufferData[m_WriteIndex++] = value >> 16;
+            m_BufferData[m_WriteIndex++] = value >> 8;
+            m_BufferData[m_WriteIndex++] = value;
+        }
+
+        void WriteString(const std::string& str) {
+            EnsureCapacity(str.length());
+            for (size_t i = 0; i < str.length(); i++) {
+                m_BufferData[m_WriteIndex++] = str[i];
+            }
+        }
+
+        std::vector<uint8_t> m_BufferData;
+
+    private:
+        size_t m_Size;
+        size_t m_WriteIndex;
+    };
+
+    std::vector<uint8_t> encodeMessage(const std::string& msg, const std::string& name, MESSAGE_TYPE type) {
+        ChatMessage message;
+        message.message = msg;
+        message.from = name;
+        message.messageLength = static_cast<uint32_t>(msg.length());
+        message.nameLength = static_cast<uint32_t>(name.length());
+        message.header.messageType = type;
+        message.header.packetSize = static_cast<uint32_t>(message.message.length() +
+            message.from.length() +
+            sizeof(message.messageLength) +
+            sizeof(message.header.messageType) +
+            sizeof(message.nameLength) +
+            sizeof(message.header.packetSize));
+
+        Buffer buffer(message.header.packetSize);
+        buffer.WriteUInt32LE(message.header.packetSize);
+        buffer.WriteUInt32LE(message.header.messageType);
+        buffer.WriteUInt32LE(message.messageLength);
+        buffer.WriteUInt32LE(message.nameLength);
+        buffer.WriteString(message.message);
+        buffer.WriteString(message.from);
+
+        buffer.m_BufferData.resize(message.header.packetSize);
+        return std::move(buffer.m_BufferData);
+    }
+}
+
+// Returns false if the two encoders disagree
+bool benchCodec(const BenchConfig& config) {
+    std::string text(64, 'x');
+    std::string name = "loadgen42";
+
+    std::vector<uint8_t> expected = legacy::encodeMessage(text, name, TEXT);
+    if (MessageCodec::Encode(TextMessage{ text, name }) != expected
+        || MessageCodec::Encode(TEXT, text, name) != expected) {
+        printf("codec: MessageCodec and the old encoder produce different frames\n");
+        return false;
+    }
+
+    // The largest frame a decoder accepts encodes; one byte more is refused
+    std::vector<uint8_t> frame;
+    std::string largest(MessageCodec::MAX_PACKET_SIZE - MessageCodec::HEADER_SIZE - name.size(), 'x');
+    if (!MessageCodec::TryEncode(TextMessage{ largest, name }, frame) || frame.size() != MessageCodec::MAX_PACKET_SIZE
+        || MessageCodec::TryEncode(TextMessage{ largest + 'x', name }, frame)) {
+        printf("codec: TryEncode does not enforce MessageCodec::MAX_PACKET_SIZE\n");
+        return false;
+    }
+
+    // Summed so the compiler can't drop the encodes
+    size_t sink = 0;
+    double legacyNs = timePerCall(config.iterations, [&] {
+        std::vector<uint8_t> frame = legacy::encodeMessage(text, name, TEXT);
+        sink += frame.size() + frame[frame.size() / 2];
+    });
+    double codecNs = timePerCall(config.iterations, [&] {
+        std::vector<uint8_t> frame = MessageCodec::Encode(TextMessage{ text, name });
+        sink += frame.size() + frame[frame.size() / 2];
+    });
+
+    printf("codec: encode %zu-byte TEXT frame, %d iterations\n", expected.size(), config.iterations);
+    printf("  Buffer encoder      %8.1f ns/frame\n", legacyNs);
+    printf("  MessageCodec        %8.1f ns/frame\n", codecNs);
+    printf("  (checksum %zu)\n", sink);
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------
+// Filter: the SIMD kernels against the scalar one and against a reference written for
+// clarity only, code point by code point and with std::string::find.
+
+namespace reference {
+    bool isValidUtf8(const std::string& text) {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+        size_t i = 0;
+        while (i < text.size()) {
+            uint8_t lead = data[i];
+            if (lead < 0x80) {
+                i++;
+                continue;
+            }
+
+            size_t length;
+            uint32_t codePoint;
+            if ((lead & 0xE0) == 0xC0) { length = 2; codePoint = lead & 0x1F; }
+            else if ((lead & 0xF0) == 0xE0) { length = 3; codePoint = lead & 0x0F; }
+            else if ((lead & 0xF8) == 0xF0) { length = 4; codePoint = lead & 0x07; }
+            else return false;
+
+            if (i + length > text.size()) {
+                return false;
+            }
+            for (size_t k = 1; k < length; k++) {
+                if ((data[i + k] & 0xC0) != 0x80) {
+                    return false;
+                }
+                codePoint = (codePoint << 6) | (data[i + k] & 0x3F);
+            }
+
+            // Overlong forms, surrogates and anything past U+10FFFF
+            static const uint32_t SMALLEST[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+            if (codePoint < SMALLEST[length] || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+                return false;
+            }
+            i += length;
+        }
+        return true;
+    }
+
+    std::string lowerAscii(std::string text) {
+        for (char& c : text) {
+            if (c >= 'A' && c <= 'Z') {
+                c += 'a' - 'A';
+            }
+        }
+        return text;
+    }
+
+    bool containsBanned(const std::string& text, const std::vector<std::string>& terms) {
+        std::string lower = lowerAscii(text);
+        for (const std::string& term : terms) {
+            if (!term.empty() && lower.find(lowerAscii(term)) != std::string::npos) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+// Every kernel this CPU can run, scalar first
+std::vector<ContentFilter::Kernel> supportedKernels() {
+    std::vector<ContentFilter::Kernel> kernels = { ContentFilter::Kernel::Scalar };
+    ContentFilter::Kernel best = ContentFilter::DetectKernel();
+    if (best == ContentFilter::Kernel::Sse42 || best == ContentFilter::Kernel::Avx2) {
+        kernels.push_back(ContentFilter::Kernel::Sse42);
+    }
+    if (best == ContentFilter::Kernel::Avx2) {
+        kernels.push_back(ContentFilter::Kernel::Avx2);
+    }
+    return kernels;
+}
+
+// A random string of ASCII letters mixed with valid and broken UTF-8 and pieces of the
+// banned terms in both cases, up to about 40 pieces long
+std::string randomText(std::mt19937& rng) {
+    static const char* PIECES[] = {
+        "a", "Z", " ", "hello", "BaD", "wOrd",
+        "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80",     // Valid 2, 3 and 4-byte sequences
+        "\xC0\x80", "\xE0\x9F\xBF",                         // Overlong
+        "\xED\xA0\x80", "\xF4\x90\x80\x80",                 // Surrogate, past U+10FFFF
+        "\x80", "\xC3", "\xE2\x82", "\xF0\x9F\x98"            // Stray continuation, truncated
+    };
+    const size_t PIECE_COUNT = sizeof(PIECES) / sizeof(PIECES[0]);
+
+    std::string text;
+    int pieces = rng() % 40;
+    for (int p = 0; p < pieces; p++) {
+        if (rng() % 4 == 0) {
+            text += PIECES[rng() % PIECE_COUNT];
+        }
+        else {
+            text.push_back(static_cast<char>((rng() % 2 ? 'A' : 'a') + rng() % 26));
+        }
+    }
+    return text;
+}
+
+// Returns false if any kernel disagrees with the reference
+bool benchFilter(const BenchConfig& config) {
+    std::vector<ContentFilter::Kernel> kernels = supportedKernels();
+    printf("filter: best kernel %s\n", ContentFilter::KernelName(ContentFilter::DetectKernel()));
+
+    const std::vector<std::vector<std::string>> TERM_SETS = {
+        { "bad" },
+        { "b" },
+        { "badword", "evil", "spam", "ab", "Hello" },
+        { "xyzzy", "BAD", "word", "lo w", "\xF0\x9F\x98\x80x" }
+    };
+
+    std::mt19937 rng(config.seed);
+    uint64_t checks = 0;
+    uint64_t failures = 0;
+    for (const std::vector<std::string>& terms : TERM_SETS) {
+        std::vector<ContentFilter> filters(kernels.size());
+        for (size_t k = 0; k < kernels.size(); k++) {
+            filters[k].Configure(0, 0, terms);
+            filters[k].SetKernel(kernels[k]);
+        }
+
+        for (int i = 0; i < config.checks; i++) {
+            std::string text = randomText(rng);
+            bool valid = reference::isValidUtf8(text);
+            bool banned = reference::containsBanned(text, terms);
+
+            for (size_t k = 0; k < kernels.size(); k++) {
+                checks++;
+                if (filters[k].IsValidUtf8(text) == valid && filters[k].ContainsBanned(text) == banned) {
+                    continue;
+                }
+
+                if (failures++ < 10) {
+                    printf("  %s disagrees on %zu bytes: utf8 %d (expected %d), banned %d (expected %d)\n",
+                        ContentFilter::KernelName(kernels[k]), text.size(),
+                        (int)filters[k].IsValidUtf8(text), (int)valid, (int)filters[k].ContainsBanned(text), (int)banned);
+                }
+            }
+        }
+    }
+    printf("  %llu checks, %llu failures\n", (unsigned long long)checks, (unsigned long long)failures);
+
+    // Timing: a 200-byte chat line against 64 random terms, which none of them match
+    std::vector<std::string> terms;
+    for (int i = 0; i < 64; i++) {
+        std::string term;
+        int length = 4 + rng() % 6;
+        for (int j = 0; j < length; j++) {
+            term.push_back(static_cast<char>('a' + rng() % 26));
+        }
+        terms.push_back(term);
+    }
+
+    std::string text;
+    while (text.size() < 200) {
+        text.push_back(static_cast<char>('a' + rng() % 26));
+        if (rng() % 6 == 0) {
+            text.push_back(' ');
+        }
+    }
+    text.resize(200);
+
+    printf("filter: %zu-byte message, %zu terms, %d iterations\n", text.size(), terms.size(), config.iterations);
+    size_t sink = 0;
+    for (ContentFilter::Kernel kernel : kernels) {
+        ContentFilter filter;
+        filter.Configure(0, 0, terms);
+        filter.SetKernel(kernel);
+
+        double utf8Ns = timePerCall(config.iterations, [&] { sink += filter.IsValidUtf8(text); });
+        double bannedNs = timePerCall(config.iterations, [&] { sink += filter.ContainsBanned(text); });
+        printf("  %-8s UTF-8 %7.1f ns   banned terms %7.1f ns (%.2f ns/byte)\n",
+            ContentFilter::KernelName(kernel), utf8Ns, bannedNs, bannedNs / text.size());
+    }
+    printf("  (checksum %zu)\n", sink);
+
+    return failures == 0;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        printUsage();
+        return 1;
+    }
+
+    bool ok = config.suite == "filter" ? benchFilter(config) : benchCodec(config);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,559 @@
+#include "ChatClient.h"
+
+#include <afunix.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string.h>
+
+#include "MessageCodec.h"
+
+namespace {
+    const size_t OUTBOUND_CAPACITY = 16 * 1024;
+
+    // Reads per readiness event, so one busy connection can't starve the rest of the loop
+    const int MAX_READS_PER_EVENT = 16;
+
+    const auto CONNECT_TIMEOUT = std::chrono::seconds(5);
+    const auto CLOSE_TIMEOUT = std::chrono::seconds(2);
+}
+
+std::shared_ptr<ChatClient> ChatClient::Create(EventLoop& loop)
+{
+    return std::shared_ptr<ChatClient>(new ChatClient(loop));
+}
+
+ChatClient::ChatClient(EventLoop& loop)
+    : m_Loop(loop)
+    , m_State(ConnectionState::Disconnected)
+    , m_LastError(0)
+    , m_FlushPosted(false)
+    , m_Outbound(OUTBOUND_CAPACITY)
+    , m_Socket(INVALID_SOCKET)
+    , m_TcpConnected(false)
+    , m_ShutdownSent(false)
+    , m_SendOffset(0)
+    , m_WantChannel(false)
+    , m_AttachPending(false)
+{
+}
+
+ChatClient::~ChatClient()
+{
+    if (m_Socket != INVALID_SOCKET) {
+        closesocket(m_Socket);
+    }
+}
+
+bool ChatClient::IsOpen() const
+{
+    ConnectionState state = State();
+    return state == ConnectionState::Connecting || state == ConnectionState::Connected;
+}
+
+bool ChatClient::Connect(const char* host, const char* port)
+{
+    ConnectionState expected = ConnectionState::Disconnected;
+    if (!m_State.compare_exchange_strong(expected, ConnectionState::Connecting)) {
+        return false;
+    }
+
+    struct addrinfo* info = nullptr;
+    struct addrinfo hints;
+
+    ZeroMemory(&hints, sizeof(hints));      // Ensure we don't have garbage data
+    hints.ai_family = AF_INET;              // IPv4
+    hints.ai_socktype = SOCK_STREAM;        // Stream
+    hints.ai_protocol = IPPROTO_TCP;        // TCP
+
+    int result = getaddrinfo(host, port, &hints, &info);
+    if (result != 0) {
+        m_LastError = result;
+        m_State = ConnectionState::Closed;
+        return false;
+    }
+
+    sockaddr_storage address;
+    ZeroMemory(&address, sizeof(address));
+    memcpy(&address, info->ai_addr, info->ai_addrlen);
+    int addressLength = static_cast<int>(info->ai_addrlen);
+    freeaddrinfo(info);
+
+    std::shared_ptr<ChatClient> self = shared_from_this();
+    m_Loop.Post([self, address, addressLength] {
+        self->Start(address, addressLength);
+    });
+
+    return true;
+}
+
+bool ChatClient::ConnectLocal(const char* path, bool sharedMemory)
+{
+    SOCKADDR_UN local;
+    ZeroMemory(&local, sizeof(local));
+    local.sun_family = AF_UNIX;
+
+    size_t pathLength = strlen(path);
+    if (pathLength >= sizeof(local.sun_path)) {
+        return false;
+    }
+
+    ConnectionState expected = ConnectionState::Disconnected;
+    if (!m_State.compare_exchange_strong(expected, ConnectionState::Connecting)) {
+        return false;
+    }
+
+    memcpy(local.sun_path, path, pathLength);
+
+    sockaddr_storage address;
+    ZeroMemory(&address, sizeof(address));
+    memcpy(&address, &local, sizeof(local));
+    int addressLength = static_cast<int>(sizeof(local));
+
+    // Read on the loop thread only after the Post below
+    m_WantChannel = sharedMemory;
+
+    std::shared_ptr<ChatClient> self = shared_from_this();
+    m_Loop.Post([self, address, addressLength] {
+        self->Start(address, addressLength);
+    });
+
+    return true;
+}
+
+void ChatClient::Close()
+{
+    ConnectionState state = State();
+    while (state == ConnectionState::Connecting || state == ConnectionState::Connected) {
+        if (m_State.compare_exchange_weak(state, ConnectionState::Closing)) {
+            break;
+        }
+    }
+
+    if (state == ConnectionState::Disconnected) {
+        m_State = ConnectionState::Closed;
+        return;
+    }
+
+    if (state == ConnectionState::Closed) {
+        return;
+    }
+
+    std::shared_ptr<ChatClient> self = shared_from_this();
+    m_Loop.Post([self] {
+        if (self->State() == ConnectionState::Closed) {
+            return;
+        }
+
+        self->m_Deadline = std::chrono::steady_clock::now() + CLOSE_TIMEOUT;
+        self->FlushOutbound();
+        if (self->WriteSocket()) {
+            self->HandleEvents(0);
+        }
+    });
+}
+
+bool ChatClient::Send(const std::string& msg, const std::string& name, MESSAGE_TYPE type)
+{
+    if (!IsOpen()) {
+        return false;
+    }
+
+    // The server drops the connection on a frame larger than it accepts, so refuse it here
+    std::vector<uint8_t> frame;
+    if (!MessageCodec::TryEncode(type, msg, name, frame)) {
+        m_LastError = WSAEMSGSIZE;
+        return false;
+    }
+
+    if (!m_Outbound.TryPush(std::move(frame))) {
+        return false;
+    }
+
+    // One flush task covers every frame queued until it runs
+    if (!m_FlushPosted.exchange(true)) {
+        std::shared_ptr<ChatClient> self = shared_from_this();
+        m_Loop.Post([self] {
+            self->m_FlushPosted.exchange(false);
+            self->FlushOutbound();
+            if (self->WriteSocket()) {
+                self->HandleEvents(0);
+            }
+        });
+    }
+
+    return true;
+}
+
+bool ChatClient::SendDirect(const std::string& to, const std::string& msg)
+{
+    return Send(msg, to, DIRECT);
+}
+
+bool ChatClient::JoinRooms(const std::string& name, const std::string& selectedRooms)
+{
+    // Only rooms whose join was actually queued are remembered
+    if (!Send(selectedRooms, name, JOIN_ROOM)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_RoomsMutex);
+
+    std::string roomName;
+    std::istringstream ss(selectedRooms);
+
+    while (std::getline(ss, roomName, ',')) {
+        // Check if 'roomName' is not empty and not already joined
+        if (!roomName.empty() && std::find(m_Rooms.begin(), m_Rooms.end(), roomName) == m_Rooms.end()) {
+            m_Rooms.push_back(roomName);
+        }
+    }
+
+    return true;
+}
+
+bool ChatClient::LeaveRoom(const std::string& name, const std::string& roomName)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_RoomsMutex);
+
+        auto it = std::find(m_Rooms.begin(), m_Rooms.end(), roomName);
+        if (it != m_Rooms.end()) {
+            m_Rooms.erase(it);
+        }
+    }
+
+    return Send(roomName, name, LEAVE_ROOM);
+}
+
+std::vector<std::string> ChatClient::Rooms() const
+{
+    std::lock_guard<std::mutex> lock(m_RoomsMutex);
+    return m_Rooms;
+}
+
+void ChatClient::Start(const sockaddr_storage& address, int addressLength)
+{
+    if (State() == ConnectionState::Closed) {
+        return;
+    }
+
+    m_Loop.Register(shared_from_this());
+    m_Deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+
+    bool local = address.ss_family == AF_UNIX;
+
+    m_Socket = socket(address.ss_family, SOCK_STREAM, local ? 0 : IPPROTO_TCP);
+    if (m_Socket == INVALID_SOCKET) {
+        Finish(WSAGetLastError());
+        return;
+    }
+
+    u_long nonBlocking = 1;
+    ioctlsocket(m_Socket, FIONBIO, &nonBlocking);
+
+    // Frames are already coalesced in m_SendBuffer; don't let Nagle delay them further.
+    if (!local) {
+        BOOL noDelay = TRUE;
+        setsockopt(m_Socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+    }
+
+    // Non-blocking connect: completion shows up as writability in the loop
+    int result = connect(m_Socket, reinterpret_cast<const sockaddr*>(&address), addressLength);
+    if (result == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
+        Finish(WSAGetLastError());
+    }
+}
+
+short ChatClient::PollEvents() const
+{
+    if (!m_TcpConnected) {
+        return POLLWRNORM;
+    }
+
+    // In ring mode a full ring is waited out on the server's doorbell, not on writability
+    short events = POLLRDNORM;
+    if (m_SendOffset < m_SendBuffer.size() && !m_AttachPending && !m_Channel) {
+        events |= POLLWRNORM;
+    }
+
+    return events;
+}
+
+// Called with the WSAPoll result, or with 0 after queueing new frames
+void ChatClient::HandleEvents(short revents)
+{
+    if (m_Socket == INVALID_SOCKET) {
+        return;
+    }
+
+    if (!m_TcpConnected) {
+        if (revents & (POLLERR | POLLHUP)) {
+            Finish(WSAECONNREFUSED);
+            return;
+        }
+
+        if (!(revents & POLLWRNORM)) {
+            return;
+        }
+
+        m_TcpConnected = true;
+
+        ConnectionState expected = ConnectionState::Connecting;
+        if (m_State.compare_exchange_strong(expected, ConnectionState::Connected) && m_OnStateChanged) {
+            m_OnStateChanged(ConnectionState::Connected, 0);
+        }
+
+        // Everything queued while connecting goes out in one batch
+        FlushOutbound();
+
+        if (m_WantChannel) {
+            // The request is the first thing on a fresh socket, so it fits in one send().
+            // Everything else waits for the reply and then goes through the ring.
+            std::vector<uint8_t> request = MessageCodec::Encode(ShmAttachMessage{});
+            int result = send(m_Socket, reinterpret_cast<const char*>(request.data()), static_cast<int>(request.size()), 0);
+            if (result != static_cast<int>(request.size())) {
+                Finish(result == SOCKET_ERROR ? WSAGetLastError() : WSAEWOULDBLOCK);
+                return;
+            }
+            m_AttachPending = true;
+        }
+    }
+
+    if (revents & (POLLRDNORM | POLLHUP | POLLERR)) {
+        if (!ReadSocket()) {
+            return;
+        }
+    }
+
+    if (!WriteSocket()) {
+        return;
+    }
+
+    // Graceful close: once everything is written, half-close and wait for the server's FIN
+    if (State() == ConnectionState::Closing && !m_ShutdownSent
+        && m_SendOffset == m_SendBuffer.size()) {
+        shutdown(m_Socket, SD_SEND);
+        m_ShutdownSent = true;
+    }
+}
+
+// Move every queued frame into the contiguous send buffer so one send() carries many frames
+void ChatClient::FlushOutbound()
+{
+    if (m_SendOffset == m_SendBuffer.size()) {
+        m_SendBuffer.clear();
+        m_SendOffset = 0;
+    }
+
+    std::vector<uint8_t> frame;
+    while (m_Outbound.TryPop(frame)) {
+        m_SendBuffer.insert(m_SendBuffer.end(), frame.begin(), frame.end());
+    }
+}
+
+// Returns false if the connection finished
+bool ChatClient::WriteSocket()
+{
+    if (m_Socket == INVALID_SOCKET) {
+        return false;
+    }
+
+    if (!m_TcpConnected || m_ShutdownSent || m_AttachPending) {
+        return true;
+    }
+
+    if (m_Channel) {
+        WriteRing();
+        return true;
+    }
+
+    while (m_SendOffset < m_SendBuffer.size()) {
+        int length = static_cast<int>(m_SendBuffer.size() - m_SendOffset);
+        int result = send(m_Socket, reinterpret_cast<const char*>(&m_SendBuffer[m_SendOffset]), length, 0);
+        if (result == SOCKET_ERROR) {
+            int errorCode = WSAGetLastError();
+            if (errorCode == WSAEWOULDBLOCK) {
+                return true;    // Kernel buffer is full, wait for POLLWRNORM
+            }
+
+            Finish(errorCode);
+            return false;
+        }
+
+        m_SendOffset += result;
+    }
+
+    return true;
+}
+
+// Returns false if the connection finished
+bool ChatClient::ReadSocket()
+{
+    std::vector<char>& recvBuffer = m_Loop.m_RecvBuffer;
+
+    for (int i = 0; i < MAX_READS_PER_EVENT; i++) {
+        int result = recv(m_Socket, recvBuffer.data(), static_cast<int>(recvBuffer.size()), 0);
+        if (result == SOCKET_ERROR) {
+            int errorCode = WSAGetLastError();
+            if (errorCode == WSAEWOULDBLOCK) {
+                break;
+            }
+
+            Finish(errorCode);
+            return false;
+        }
+
+        if (result == 0) {
+            // Server closed the connection, or acknowledged our half-close.
+            // Whatever it put in the ring before closing is still delivered.
+            if (m_Channel && !ReadRing()) {
+                return false;
+            }
+            Finish(0);
+            return false;
+        }
+
+        if (m_Channel) {
+            continue;   // Doorbells carry no data
+        }
+
+        m_Decoder.Append(recvBuffer.data(), result);
+        if (!DeliverFrames()) {
+            return false;
+        }
+
+        if (result < static_cast<int>(recvBuffer.size())) {
+            break;      // Drained what the kernel had
+        }
+    }
+
+    if (m_Channel) {
+        return ReadRing();
+    }
+
+    return true;
+}
+
+// Hand every complete frame in the decoder to the message handler.
+// Returns false if the connection finished.
+bool ChatClient::DeliverFrames()
+{
+    try {
+        ChatMessage message;
+        while (m_Decoder.Next(message)) {
+            if (m_AttachPending && message.header.messageType == SHM_ATTACH) {
+                std::unique_ptr<SharedMemoryChannel> channel(new SharedMemoryChannel());
+                if (!channel->Open(std::string(MessageCodec::Decode<ShmAttachMessage>(message).mapping))) {
+                    Finish(GetLastError() != 0 ? static_cast<int>(GetLastError()) : WSAEINVAL);
+                    return false;
+                }
+
+                // The reply was the server's last frame on the socket
+                m_Channel = std::move(channel);
+                m_AttachPending = false;
+                m_Decoder = FrameDecoder();
+                return true;
+            }
+
+            if (m_OnMessage) {
+                m_OnMessage(message);
+            }
+        }
+    }
+    catch (const std::runtime_error&) {
+        Finish(WSAEMSGSIZE);
+        return false;
+    }
+
+    return true;
+}
+
+// Drain the inbound ring, then ask for a doorbell before going back to sleep.
+// Returns false if the connection finished.
+bool ChatClient::ReadRing()
+{
+    SharedRing& ring = m_Channel->Inbound();
+    std::vector<char>& recvBuffer = m_Loop.m_RecvBuffer;
+    bool armed = false;
+
+    for (;;) {
+        size_t count = ring.Read(recvBuffer.data(), recvBuffer.size());
+        if (count > 0) {
+            if (ring.TakeWriterWaiting()) {
+                RingDoorbell();
+            }
+
+            m_Decoder.Append(recvBuffer.data(), count);
+            if (!DeliverFrames()) {
+                return false;
+            }
+            continue;
+        }
+
+        // Bytes written before the server could see the request won't ring; look once more
+        if (armed) {
+            return true;
+        }
+        ring.SetReaderWaiting();
+        armed = true;
+    }
+}
+
+// Copy as much pending output as fits into the outbound ring
+void ChatClient::WriteRing()
+{
+    SharedRing& ring = m_Channel->Outbound();
+
+    size_t pending = m_SendBuffer.size() - m_SendOffset;
+    if (pending == 0) {
+        return;
+    }
+
+    size_t written = ring.Write(&m_SendBuffer[m_SendOffset], pending);
+    if (written < pending) {
+        // Full: the server rings once it has made room; retry once in case it already has
+        ring.SetWriterWaiting();
+        written += ring.Write(&m_SendBuffer[m_SendOffset + written], pending - written);
+    }
+
+    m_SendOffset += written;
+
+    if (written > 0 && ring.TakeReaderWaiting()) {
+        RingDoorbell();
+    }
+}
+
+void ChatClient::RingDoorbell()
+{
+    // A full socket buffer already holds doorbells the server hasn't read yet
+    char doorbell = 1;
+    send(m_Socket, &doorbell, 1, 0);
+}
+
+void ChatClient::CheckDeadline(std::chrono::steady_clock::time_point now)
+{
+    ConnectionState state = State();
+    if ((state == ConnectionState::Connecting || state == ConnectionState::Closing) && now >= m_Deadline) {
+        Finish(state == ConnectionState::Connecting ? WSAETIMEDOUT : 0);
+    }
+}
+
+void ChatClient::Finish(int errorCode)
+{
+    if (State() == ConnectionState::Closed) {
+        return;
+    }
+
+    if (m_Socket != INVALID_SOCKET) {
+        closesocket(m_Socket);
+        m_Socket = INVALID_SOCKET;
+    }
+
+    m_LastError = errorCode;
+    m_State = ConnectionState::Closed;
+
+    if (m_OnStateChanged) {
+        m_OnStateChanged(ConnectionState::Closed, errorCode);
+    }
+}
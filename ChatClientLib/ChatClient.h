@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "EventLoop.h"
+#include "Message.h"
+#include "FrameDecoder.h"
+#include "MPSCQueue.h"
+#include "SharedMemoryChannel.h"
+
+// Lifecycle of a ChatClient. Transitions only move forward:
+// Disconnected -> Connecting -> Connected -> Closing -> Closed
+enum class ConnectionState {
+    Disconnected, Connecting, Connected, Closing, Closed
+};
+
+// Non-blocking chat connection driven by a shared EventLoop.
+//
+// Connect, JoinRooms, LeaveRoom, Send and Close are safe from any thread and never block:
+// frames are queued immediately (even while the TCP connect is still in flight) and the
+// loop writes them out back-to-back, so callers can pipeline as many requests as they like.
+// Handlers are invoked on the loop thread and must be set before Connect().
+class ChatClient : public std::enable_shared_from_this<ChatClient>
+{
+public:
+    typedef std::function<void(const ChatMessage&)> MessageHandler;
+    typedef std::function<void(ConnectionState state, int errorCode)> StateHandler;
+
+    static std::shared_ptr<ChatClient> Create(EventLoop& loop);
+
+    ~ChatClient();
+
+    ChatClient(const ChatClient&) = delete;
+    ChatClient& operator=(const ChatClient&) = delete;
+
+    void OnMessage(MessageHandler handler) { m_OnMessage = std::move(handler); }
+    void OnStateChanged(StateHandler handler) { m_OnStateChanged = std::move(handler); }
+
+    // Resolve and start connecting. Returns false if the address can't be resolved
+    // or the client was already used; the outcome is reported through OnStateChanged.
+    bool Connect(const char* host, const char* port);
+
+    // Connect to a server on this machine through its AF_UNIX socket. With 'sharedMemory'
+    // the frames then move to a shared-memory ring the server sets up for this client;
+    // everything else, including the handlers and the room protocol, is unchanged.
+    bool ConnectLocal(const char* path, bool sharedMemory = false);
+
+    // Flush queued frames, then close. The Closed state is reported through OnStateChanged.
+    void Close();
+
+    // Queue a message. Returns false if the client is closing or the outbound queue is full,
+    // or, with LastError() set to WSAEMSGSIZE, if the frame would exceed MessageCodec::MAX_PACKET_SIZE.
+    bool Send(const std::string& msg, const std::string& name, MESSAGE_TYPE type);
+
+    // Queue a DIRECT message for one user, wherever they are; the server fills in the sender
+    bool SendDirect(const std::string& to, const std::string& msg);
+
+    // Join the comma-separated list of rooms, remembering each one locally
+    bool JoinRooms(const std::string& name, const std::string& selectedRooms);
+
+    // Leave a single room
+    bool LeaveRoom(const std::string& name, const std::string& roomName);
+
+    // Snapshot of the rooms this client is in
+    std::vector<std::string> Rooms() const;
+
+    ConnectionState State() const { return m_State.load(std::memory_order_acquire); }
+    bool IsOpen() const;
+    int LastError() const { return m_LastError.load(std::memory_order_relaxed); }
+
+private:
+    friend class EventLoop;
+
+    explicit ChatClient(EventLoop& loop);
+
+    // I/O thread only
+    void Start(const sockaddr_storage& address, int addressLength);
+    short PollEvents() const;
+    void HandleEvents(short revents);
+    void FlushOutbound();
+    bool ReadSocket();
+    bool WriteSocket();
+    bool ReadRing();
+    void WriteRing();
+    bool DeliverFrames();
+    void RingDoorbell();
+    void CheckDeadline(std::chrono::steady_clock::time_point now);
+    void Finish(int errorCode);
+
+    EventLoop& m_Loop;
+
+    std::atomic<ConnectionState> m_State;
+    std::atomic<int> m_LastError;
+    std::atomic<bool> m_FlushPosted;
+
+    MPSCQueue<std::vector<uint8_t>> m_Outbound;
+
+    MessageHandler m_OnMessage;
+    StateHandler m_OnStateChanged;
+
+    // Owned by the I/O thread
+    SOCKET m_Socket;
+    bool m_TcpConnected;
+    bool m_ShutdownSent;
+    std::chrono::steady_clock::time_point m_Deadline;    // Connect or graceful close timeout
+    FrameDecoder m_Decoder;
+    std::vector<uint8_t> m_SendBuffer;
+    size_t m_SendOffset;
+
+    // Shared-memory transport: requested at connect, live once the server's reply is in
+    bool m_WantChannel;
+    bool m_AttachPending;
+    std::unique_ptr<SharedMemoryChannel> m_Channel;
+
+    mutable std::mutex m_RoomsMutex;
+    std::vector<std::string> m_Rooms;
+};
@@ -0,0 +1,244 @@
+#include "EventLoop.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "ChatClient.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace {
+    const size_t TASK_CAPACITY = 64 * 1024;
+    const size_t RECV_BUFFER_SIZE = 64 * 1024;
+
+    // Upper bound on tasks run per loop turn, so sockets are still serviced under a Post() flood
+    const int MAX_TASKS_PER_TURN = 4096;
+
+    // Poll interval while something has a deadline (connect, close, stop)
+    const int DEADLINE_POLL_MS = 100;
+
+    // How long Stop() waits for connections to flush before closing them hard
+    const auto STOP_TIMEOUT = std::chrono::seconds(2);
+
+    // The loop running on the current thread, if any
+    thread_local const EventLoop* currentLoop = nullptr;
+}
+
+EventLoop::EventLoop()
+    : m_WakeSocket(INVALID_SOCKET)
+    , m_WakePending(false)
+    , m_Stopping(false)
+    , m_Tasks(TASK_CAPACITY)
+    , m_RecvBuffer(RECV_BUFFER_SIZE)
+{
+}
+
+EventLoop::~EventLoop()
+{
+    Stop();
+}
+
+bool EventLoop::Start()
+{
+    if (m_Thread.joinable() || !CreateWakeSocket()) {
+        return false;
+    }
+
+    m_Stopping = false;
+    m_Thread = std::thread(&EventLoop::Run, this);
+    return true;
+}
+
+void EventLoop::Stop()
+{
+    if (!m_Thread.joinable()) {
+        return;
+    }
+
+    m_Stopping = true;
+    Post([this] {
+        for (const std::shared_ptr<ChatClient>& client : m_Connections) {
+            client->Close();
+        }
+    });
+
+    m_Thread.join();
+
+    closesocket(m_WakeSocket);
+    m_WakeSocket = INVALID_SOCKET;
+}
+
+void EventLoop::Post(std::function<void()> task)
+{
+    while (!m_Tasks.TryPush(std::move(task))) {
+        if (IsLoopThread()) {
+            // The loop can't drain its own queue while we wait here; run the task in place.
+            task();
+            return;
+        }
+        std::this_thread::yield();
+    }
+
+    Wake();
+}
+
+bool EventLoop::IsLoopThread() const
+{
+    return currentLoop == this;
+}
+
+void EventLoop::Register(const std::shared_ptr<ChatClient>& client)
+{
+    m_Connections.push_back(client);
+}
+
+void EventLoop::RemoveClosed()
+{
+    auto closed = std::remove_if(m_Connections.begin(), m_Connections.end(),
+        [](const std::shared_ptr<ChatClient>& c) { return c->State() == ConnectionState::Closed; });
+
+    m_Connections.erase(closed, m_Connections.end());
+}
+
+// Loopback UDP socket connected to itself: a send() from any thread makes it readable,
+// which is the portable way to interrupt a WSAPoll that is waiting on other sockets.
+bool EventLoop::CreateWakeSocket()
+{
+    m_WakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_WakeSocket == INVALID_SOCKET) {
+        return false;
+    }
+
+    sockaddr_in addr;
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    int addrLength = sizeof(addr);
+    if (bind(m_WakeSocket, reinterpret_cast<sockaddr*>(&addr), addrLength) == SOCKET_ERROR
+        || getsockname(m_WakeSocket, reinterpret_cast<sockaddr*>(&addr), &addrLength) == SOCKET_ERROR
+        || connect(m_WakeSocket, reinterpret_cast<sockaddr*>(&addr), addrLength) == SOCKET_ERROR) {
+        closesocket(m_WakeSocket);
+        m_WakeSocket = INVALID_SOCKET;
+        return false;
+    }
+
+    u_long nonBlocking = 1;
+    ioctlsocket(m_WakeSocket, FIONBIO, &nonBlocking);
+
+    return true;
+}
+
+void EventLoop::Wake()
+{
+    // Only one wake byte needs to be in flight; the loop re-arms the flag before draining.
+    if (!m_WakePending.exchange(true)) {
+        send(m_WakeSocket, "w", 1, 0);
+    }
+}
+
+void EventLoop::DrainWakeSocket()
+{
+    char scratch[64];
+    while (recv(m_WakeSocket, scratch, sizeof(scratch), 0) > 0) {
+    }
+}
+
+// Returns true if tasks are still queued after this turn's budget
+bool EventLoop::RunTasks()
+{
+    std::function<void()> task;
+    for (int i = 0; i < MAX_TASKS_PER_TURN; i++) {
+        if (!m_Tasks.TryPop(task)) {
+            return false;
+        }
+        task();
+    }
+
+    return true;
+}
+
+void EventLoop::Run()
+{
+    currentLoop = this;
+
+    bool stopDeadlineSet = false;
+    std::chrono::steady_clock::time_point stopDeadline;
+
+    for (;;) {
+        // Re-arm the wake flag before draining so a concurrent Post() always wakes us again.
+        m_WakePending.exchange(false);
+        bool tasksPending = RunTasks();
+
+        auto now = std::chrono::steady_clock::now();
+
+        if (m_Stopping) {
+            if (!stopDeadlineSet) {
+                stopDeadlineSet = true;
+                stopDeadline = now + STOP_TIMEOUT;
+            }
+
+            if (now >= stopDeadline) {
+                for (const std::shared_ptr<ChatClient>& client : m_Connections) {
+                    client->Finish(WSAECONNRESET);
+                }
+            }
+        }
+
+        // Connections finish from tasks and handlers; drop them only here, never mid-dispatch.
+        RemoveClosed();
+
+        if (m_Stopping && m_Connections.empty()) {
+            break;
+        }
+
+        // Slot 0 is the wake socket, slot i + 1 is m_Connections[i]
+        size_t connectionCount = m_Connections.size();
+        bool hasDeadline = m_Stopping;
+
+        m_PollFds.resize(connectionCount + 1);
+        m_PollFds[0].fd = m_WakeSocket;
+        m_PollFds[0].events = POLLRDNORM;
+        m_PollFds[0].revents = 0;
+
+        for (size_t i = 0; i < connectionCount; i++) {
+            const ChatClient& client = *m_Connections[i];
+            m_PollFds[i + 1].fd = client.m_Socket;
+            m_PollFds[i + 1].events = client.PollEvents();
+            m_PollFds[i + 1].revents = 0;
+
+            if (client.State() != ConnectionState::Connected) {
+                hasDeadline = true;
+            }
+        }
+
+        int timeout = tasksPending ? 0 : (hasDeadline ? DEADLINE_POLL_MS : -1);
+        int count = WSAPoll(m_PollFds.data(), static_cast<ULONG>(m_PollFds.size()), timeout);
+        if (count == SOCKET_ERROR) {
+            // Nothing sensible to retry immediately; back off and rebuild the poll set.
+            Sleep(1);
+            continue;
+        }
+
+        if (m_PollFds[0].revents & POLLRDNORM) {
+            DrainWakeSocket();
+        }
+
+        // m_Connections doesn't change during dispatch: closed clients stay in place until RemoveClosed()
+        for (size_t i = 0; i < connectionCount && count > 0; i++) {
+            short revents = m_PollFds[i + 1].revents;
+            if (revents != 0) {
+                count--;
+                m_Connections[i]->HandleEvents(revents);
+            }
+        }
+
+        if (hasDeadline) {
+            now = std::chrono::steady_clock::now();
+            for (const std::shared_ptr<ChatClient>& client : m_Connections) {
+                client->CheckDeadline(now);
+            }
+        }
+    }
+}
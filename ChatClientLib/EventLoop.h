@@ -0,0 +1,67 @@
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <Windows.h>
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "MPSCQueue.h"
+
+class ChatClient;
+
+// One I/O thread multiplexing any number of ChatClient connections with WSAPoll.
+// Every socket operation and every user callback runs on this thread; other threads
+// talk to it only through Post(), which is lock-free.
+class EventLoop
+{
+public:
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Start the I/O thread. Returns false if the wake socket could not be created.
+    bool Start();
+
+    // Close every connection (flushing what is queued, bounded by a timeout) and join the I/O thread
+    void Stop();
+
+    // Run 'task' on the I/O thread. Safe from any thread, including the I/O thread itself.
+    void Post(std::function<void()> task);
+
+    bool IsLoopThread() const;
+
+private:
+    friend class ChatClient;
+
+    // I/O thread only
+    void Register(const std::shared_ptr<ChatClient>& client);
+    void RemoveClosed();
+
+    void Run();
+    void Wake();
+    bool CreateWakeSocket();
+    void DrainWakeSocket();
+    bool RunTasks();
+
+    SOCKET m_WakeSocket;    // Loopback UDP socket connected to itself, used to interrupt WSAPoll
+    std::atomic<bool> m_WakePending;
+    std::atomic<bool> m_Stopping;
+
+    std::thread m_Thread;
+
+    MPSCQueue<std::function<void()>> m_Tasks;
+
+    // Owned by the I/O thread
+    std::vector<std::shared_ptr<ChatClient>> m_Connections;
+    std::vector<WSAPOLLFD> m_PollFds;
+    std::vector<char> m_RecvBuffer;     // Shared by every connection; only one reads at a time
+};
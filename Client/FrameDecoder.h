@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "Message.h"
+#include "MessageCodec.h"
+
+// Streaming decoder for the chat wire format.
+// TCP is a byte stream, so a single recv() can hold a partial packet or several
+// coalesced packets. Bytes are appended as they arrive and complete frames are
+// pulled out one by one using the packetSize in each header.
+class FrameDecoder
+{
+public:
+    static constexpr uint32_t HEADER_SIZE = MessageCodec::HEADER_SIZE;
+    static constexpr uint32_t MAX_PACKET_SIZE = MessageCodec::MAX_PACKET_SIZE;
+
+    FrameDecoder()
+    {
+        m_ReadIndex = 0;
+    }
+
+    ~FrameDecoder() { }
+
+    // Append raw bytes received from the socket
+    void Append(const char* data, size_t length)
+    {
+        // Reclaim the consumed prefix once it dominates the storage
+        if (m_ReadIndex > 0 && m_ReadIndex >= m_Data.size() / 2)
+        {
+            m_Data.erase(m_Data.begin(), m_Data.begin() + m_ReadIndex);
+            m_ReadIndex = 0;
+        }
+
+        m_Data.insert(m_Data.end(), data, data + length);
+    }
+
+    // True if Next() would produce a frame (or report a malformed one) without more bytes
+    bool HasFrame() const
+    {
+        size_t available = m_Data.size() - m_ReadIndex;
+        if (available < HEADER_SIZE)
+        {
+            return false;
+        }
+
+        // A bad size counts as ready so Next() gets to report it
+        uint32_t packetSize = MessageCodec::ReadUInt32(&m_Data[m_ReadIndex]);
+        return packetSize < HEADER_SIZE || packetSize > MAX_PACKET_SIZE || available >= packetSize;
+    }
+
+    // Decode the next complete frame into 'message'.
+    // Returns false if more bytes are needed, throws if the stream is malformed.
+    bool Next(ChatMessage& message)
+    {
+        size_t available = m_Data.size() - m_ReadIndex;
+        if (available < HEADER_SIZE)
+        {
+            return false;
+        }
+
+        const uint8_t* frame = &m_Data[m_ReadIndex];
+
+        uint32_t packetSize = MessageCodec::ReadUInt32(frame);
+        if (packetSize < HEADER_SIZE || packetSize > MAX_PACKET_SIZE)
+        {
+            throw std::runtime_error("Malformed frame: invalid packet size.");
+        }
+
+        if (available < packetSize)
+        {
+            return false;
+        }
+
+        MessageCodec::DecodeFrame(frame, packetSize, message);
+
+        m_ReadIndex += packetSize;
+        return true;
+    }
+
+private:
+    std::vector<uint8_t> m_Data;
+    size_t m_ReadIndex;
+};
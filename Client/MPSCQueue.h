@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded lock-free queue for any number of producer threads and one consumer thread.
+// Each slot carries a sequence number (Vyukov's bounded queue), so producers claim a
+// slot with a single CAS on the tail and never wait on each other while copying.
+template <typename T>
+class MPSCQueue
+{
+public:
+    MPSCQueue(size_t capacity = 4096)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+
+        m_Slots = std::vector<Slot>(size);
+        for (size_t i = 0; i < size; i++)
+        {
+            m_Slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        m_Mask = size - 1;
+        m_Head = 0;
+        m_Tail.store(0, std::memory_order_relaxed);
+    }
+
+    ~MPSCQueue() { }
+
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    // Safe from any thread. Returns false if the queue is full, 'value' is left untouched.
+    bool TryPush(T&& value)
+    {
+        size_t tail = m_Tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot& slot = m_Slots[tail & m_Mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(tail);
+
+            if (diff == 0)
+            {
+                if (m_Tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+                {
+                    slot.value = std::move(value);
+                    slot.sequence.store(tail + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                tail = m_Tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer thread only. Returns false if the queue is empty.
+    bool TryPop(T& value)
+    {
+        Slot& slot = m_Slots[m_Head & m_Mask];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != m_Head + 1)
+        {
+            return false;
+        }
+
+        value = std::move(slot.value);
+        slot.sequence.store(m_Head + m_Mask + 1, std::memory_order_release);
+        m_Head++;
+        return true;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+
+        Slot() : sequence(0) { }
+        Slot(const Slot&) : sequence(0) { }
+    };
+
+    std::vector<Slot> m_Slots;
+    size_t m_Mask;
+
+    alignas(64) size_t m_Head;      // Owned by the consumer
+    alignas(64) std::atomic<size_t> m_Tail;
+};
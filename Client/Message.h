@@ -19,5 +19,18 @@ struct ChatMessage
 };
 
 enum MESSAGE_TYPE {
-	NOTIFICATION = 1, TEXT = 2, JOIN_ROOM = 3, LEAVE_ROOM = 4
+	NOTIFICATION = 1, TEXT = 2, JOIN_ROOM = 3, LEAVE_ROOM = 4,
+
+	// Local clients only: request a shared-memory channel; the server answers with the mapping name
+	SHM_ATTACH = 5,
+
+	// Server to client: members who joined or left a room since the last one
+	PRESENCE = 6,
+
+	// A message for one user, whatever rooms they are in; held for them if they are offline
+	DIRECT = 7,
+
+	// Server-to-server messages on cluster links; never sent to clients
+	NODE_HELLO = 100, NODE_ROOM_JOIN = 101, NODE_ROOM_LEAVE = 102, NODE_ROUTE = 103, NODE_DELIVER = 104,
+	NODE_USER_UP = 105, NODE_USER_DOWN = 106, NODE_DIRECT = 107
 };
\ No newline at end of file
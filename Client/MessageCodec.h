@@ -0,0 +1,336 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Message.h"
+
+// The chat wire format, declared once.
+//
+// Every frame is four big-endian uint32s (packetSize, messageType, messageLength,
+// nameLength) followed by the message bytes and then the name bytes. Each message type
+// below lists, in wire order, which of its fields fill those two variable-length slots.
+// Encoders, decoders, sizes and the dispatch table are all generated from these lists,
+// so a new type or a layout change is made in exactly one place.
+
+// Fields of a message type: pointers to its std::string_view members, in slot order
+template <auto... Members>
+struct FieldList
+{
+    static_assert(sizeof...(Members) <= 2, "A frame has two variable-length slots");
+
+    typedef std::array<std::string_view, 2> Slots;
+
+    // Slots a message type doesn't use are empty
+    template <typename T>
+    static Slots Get(const T& message)
+    {
+        return Slots{ { (message.*Members)... } };
+    }
+
+    template <typename T>
+    static void Set(T& message, const Slots& slots)
+    {
+        size_t slot = 0;
+        ((message.*Members = slots[slot++]), ...);
+        (void)slot;
+    }
+};
+
+// Client <-> server
+
+struct NotificationMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = NOTIFICATION;
+    std::string_view text;
+    std::string_view name;
+    typedef FieldList<&NotificationMessage::text, &NotificationMessage::name> Fields;
+};
+
+struct TextMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = TEXT;
+    std::string_view text;
+    std::string_view name;
+    typedef FieldList<&TextMessage::text, &TextMessage::name> Fields;
+};
+
+struct JoinRoomMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = JOIN_ROOM;
+    std::string_view rooms;         // Comma-separated
+    std::string_view name;
+    typedef FieldList<&JoinRoomMessage::rooms, &JoinRoomMessage::name> Fields;
+};
+
+struct LeaveRoomMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = LEAVE_ROOM;
+    std::string_view room;
+    std::string_view name;
+    typedef FieldList<&LeaveRoomMessage::room, &LeaveRoomMessage::name> Fields;
+};
+
+// Batched join/leave notices for one room. 'changes' holds one line per member, "+name"
+// for joined and "-name" for left; a member who did both within the batch is left out.
+struct PresenceMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = PRESENCE;
+    std::string_view room;
+    std::string_view changes;
+    typedef FieldList<&PresenceMessage::room, &PresenceMessage::changes> Fields;
+};
+
+// 'peer' is the recipient on the way to the server and the sender on the way out;
+// the server fills in the sender itself, so it can't be forged
+struct DirectMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = DIRECT;
+    std::string_view text;
+    std::string_view peer;
+    typedef FieldList<&DirectMessage::text, &DirectMessage::peer> Fields;
+};
+
+// Empty from the client; the server's reply carries the mapping name
+struct ShmAttachMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = SHM_ATTACH;
+    std::string_view mapping;
+    typedef FieldList<&ShmAttachMessage::mapping> Fields;
+};
+
+// Server <-> server
+
+// The first frame each way on a cluster link; 'key' is the cluster's shared key
+struct NodeHelloMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = NODE_HELLO;
+    std::string_view nodeId;
+    std::string_view key;
+    typedef FieldList<&NodeHelloMessage::nodeId, &NodeHelloMessage::key> Fields;
+};
+
+struct NodeRoomJoinMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = NODE_ROOM_JOIN;
+    std::string_view room;
+    std::string_view nodeId;
+    typedef FieldList<&NodeRoomJoinMessage::room, &NodeRoomJoinMessage::nodeId> Fields;
+};
+
+struct NodeRoomLeaveMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = NODE_ROOM_LEAVE;
+    std::string_view room;
+    std::string_view nodeId;
+    typedef FieldList<&NodeRoomLeaveMessage::room, &NodeRoomLeaveMessage::nodeId> Fields;
+};
+
+// A client frame for the owner of one of 'header's rooms to deliver and pass on
+struct NodeRouteMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = NODE_ROUTE;
+    std::string_view frame;
+    std::string_view header;        // "<origin node>:<room>,<room>,..."
+    typedef FieldList<&NodeRouteMessage::frame, &NodeRouteMessage::header> Fields;
+};
+
+// A client frame to deliver locally only
+struct NodeDeliverMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = NODE_DELIVER;
+    std::string_view frame;
+    std::string_view header;
+    typedef FieldList<&NodeDeliverMessage::frame, &NodeDeliverMessage::header> Fields;
+};
+
+// A user connected to (up) or gone from (down) 'nodeId', sent to the owner of their name
+struct NodeUserUpMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = NODE_USER_UP;
+    std::string_view name;
+    std::string_view nodeId;
+    typedef FieldList<&NodeUserUpMessage::name, &NodeUserUpMessage::nodeId> Fields;
+};
+
+struct NodeUserDownMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = NODE_USER_DOWN;
+    std::string_view name;
+    std::string_view nodeId;
+    typedef FieldList<&NodeUserDownMessage::name, &NodeUserDownMessage::nodeId> Fields;
+};
+
+// A DIRECT frame, already stamped with its sender, on its way to 'target'
+struct NodeDirectMessage
+{
+    static constexpr MESSAGE_TYPE TYPE = NODE_DIRECT;
+    std::string_view frame;
+    std::string_view target;
+    typedef FieldList<&NodeDirectMessage::frame, &NodeDirectMessage::target> Fields;
+};
+
+class MessageCodec
+{
+public:
+    // Fixed part of every packet: packetSize, messageType, messageLength, nameLength
+    static constexpr uint32_t HEADER_SIZE = 4 * sizeof(uint32_t);
+
+    // Anything larger than this is treated as a corrupt stream
+    static constexpr uint32_t MAX_PACKET_SIZE = 64 * 1024;
+
+    // Size of the frame Encode() would produce for 'message'
+    template <typename T>
+    static size_t FrameSize(const T& message)
+    {
+        typename T::Fields::Slots slots = T::Fields::Get(message);
+        return FrameSize(slots[0], slots[1]);
+    }
+
+    static size_t FrameSize(std::string_view message, std::string_view name)
+    {
+        return HEADER_SIZE + message.size() + name.size();
+    }
+
+    // Encode into a vector of exactly the frame's size: one allocation, no intermediate copies.
+    // The frame must fit in MAX_PACKET_SIZE, or the receiving decoder drops the connection;
+    // debug builds assert it. Use TryEncode() when the sizes come from outside.
+    template <typename T>
+    static std::vector<uint8_t> Encode(const T& message)
+    {
+        typename T::Fields::Slots slots = T::Fields::Get(message);
+        return EncodeSlots(T::TYPE, slots[0], slots[1]);
+    }
+
+    // For callers that only know the type at run time; same layout as Encode()
+    static std::vector<uint8_t> Encode(MESSAGE_TYPE type, std::string_view message, std::string_view name)
+    {
+        return EncodeSlots(type, message, name);
+    }
+
+    // Encode() for frames that may be too large: returns false and leaves 'frame' alone
+    // if the result would exceed MAX_PACKET_SIZE
+    template <typename T>
+    static bool TryEncode(const T& message, std::vector<uint8_t>& frame)
+    {
+        typename T::Fields::Slots slots = T::Fields::Get(message);
+        return TryEncode(T::TYPE, slots[0], slots[1], frame);
+    }
+
+    static bool TryEncode(MESSAGE_TYPE type, std::string_view message, std::string_view name, std::vector<uint8_t>& frame)
+    {
+        if (FrameSize(message, name) > MAX_PACKET_SIZE)
+        {
+            return false;
+        }
+        frame = EncodeSlots(type, message, name);
+        return true;
+    }
+
+    // View 'frame', which the caller has checked is a T. The fields point into 'frame'
+    // and are valid as long as it is.
+    template <typename T>
+    static T Decode(const ChatMessage& frame)
+    {
+        T message;
+        T::Fields::Set(message, typename T::Fields::Slots{ { frame.message, frame.from } });
+        return message;
+    }
+
+    // Decode the frame at 'data', whose header has already been found to describe
+    // 'packetSize' available bytes. Throws if the field lengths don't fit.
+    static void DecodeFrame(const uint8_t* data, uint32_t packetSize, ChatMessage& message)
+    {
+        message.header.packetSize = packetSize;
+        message.header.messageType = ReadUInt32(data + 4);
+        message.messageLength = ReadUInt32(data + 8);
+        message.nameLength = ReadUInt32(data + 12);
+
+        if (static_cast<uint64_t>(message.messageLength) + message.nameLength > packetSize - HEADER_SIZE)
+        {
+            throw std::runtime_error("Malformed frame: field lengths exceed packet size.");
+        }
+
+        // assign() reuses the strings' capacity, so a reused ChatMessage stops allocating
+        const char* body = reinterpret_cast<const char*>(data + HEADER_SIZE);
+        message.message.assign(body, message.messageLength);
+        message.from.assign(body + message.messageLength, message.nameLength);
+    }
+
+    static uint32_t ReadUInt32(const uint8_t* data)
+    {
+        return (static_cast<uint32_t>(data[0]) << 24)
+            | (static_cast<uint32_t>(data[1]) << 16)
+            | (static_cast<uint32_t>(data[2]) << 8)
+            | static_cast<uint32_t>(data[3]);
+    }
+
+private:
+    static void WriteUInt32(uint8_t* data, uint32_t value)
+    {
+        data[0] = static_cast<uint8_t>(value >> 24);
+        data[1] = static_cast<uint8_t>(value >> 16);
+        data[2] = static_cast<uint8_t>(value >> 8);
+        data[3] = static_cast<uint8_t>(value);
+    }
+
+    static std::vector<uint8_t> EncodeSlots(MESSAGE_TYPE type, std::string_view message, std::string_view name)
+    {
+        assert(FrameSize(message, name) <= MAX_PACKET_SIZE && "frame exceeds MessageCodec::MAX_PACKET_SIZE");
+        uint32_t packetSize = static_cast<uint32_t>(FrameSize(message, name));
+
+        std::vector<uint8_t> frame(packetSize);
+        uint8_t* out = frame.data();
+        WriteUInt32(out, packetSize);
+        WriteUInt32(out + 4, type);
+        WriteUInt32(out + 8, static_cast<uint32_t>(message.size()));
+        WriteUInt32(out + 12, static_cast<uint32_t>(name.size()));
+        memcpy(out + HEADER_SIZE, message.data(), message.size());
+        memcpy(out + HEADER_SIZE + message.size(), name.data(), name.size());
+        return frame;
+    }
+};
+
+// Calls handler.On(const T&) for a frame of any of 'Messages' through a table indexed by
+// message type, built at compile time. Frames of other types return Result().
+template <typename Handler, typename Result, typename... Messages>
+class MessageDispatcher
+{
+public:
+    static Result Dispatch(Handler& handler, const ChatMessage& frame)
+    {
+        uint32_t type = frame.header.messageType;
+        if (type >= TABLE_SIZE || TABLE[type] == nullptr)
+        {
+            return Result();
+        }
+        return TABLE[type](handler, frame);
+    }
+
+private:
+    typedef Result (*Entry)(Handler& handler, const ChatMessage& frame);
+
+    template <typename T>
+    static Result Invoke(Handler& handler, const ChatMessage& frame)
+    {
+        return handler.On(MessageCodec::Decode<T>(frame));
+    }
+
+    static constexpr size_t TABLE_SIZE = (std::max)({ static_cast<size_t>(Messages::TYPE)... }) + 1;
+
+    static constexpr std::array<Entry, TABLE_SIZE> MakeTable()
+    {
+        std::array<Entry, TABLE_SIZE> table{};
+        ((table[Messages::TYPE] = &Invoke<Messages>), ...);
+        return table;
+    }
+
+    static constexpr std::array<Entry, TABLE_SIZE> TABLE = MakeTable();
+};
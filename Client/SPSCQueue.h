@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <stddef.h>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Capacity is rounded up to a power of two so the ring index is a mask, not a modulo.
+template <typename T>
+class SPSCQueue
+{
+public:
+    SPSCQueue(size_t capacity = 4096)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+
+        m_Slots.resize(size);
+        m_Mask = size - 1;
+        m_Head.store(0, std::memory_order_relaxed);
+        m_Tail.store(0, std::memory_order_relaxed);
+    }
+
+    ~SPSCQueue() { }
+
+    SPSCQueue(const SPSCQueue&) = delete;
+    SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+    // Producer side. Returns false if the queue is full, 'value' is left untouched.
+    bool TryPush(T&& value)
+    {
+        size_t tail = m_Tail.load(std::memory_order_relaxed);
+        if (tail - m_CachedHead > m_Mask)
+        {
+            m_CachedHead = m_Head.load(std::memory_order_acquire);
+            if (tail - m_CachedHead > m_Mask)
+            {
+                return false;
+            }
+        }
+
+        m_Slots[tail & m_Mask] = std::move(value);
+        m_Tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the queue is empty.
+    bool TryPop(T& value)
+    {
+        size_t head = m_Head.load(std::memory_order_relaxed);
+        if (head == m_CachedTail)
+        {
+            m_CachedTail = m_Tail.load(std::memory_order_acquire);
+            if (head == m_CachedTail)
+            {
+                return false;
+            }
+        }
+
+        value = std::move(m_Slots[head & m_Mask]);
+        m_Head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate, only meaningful as a hint from either side.
+    bool Empty() const
+    {
+        return m_Head.load(std::memory_order_acquire) == m_Tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> m_Slots;
+    size_t m_Mask;
+
+    // Head and tail live on their own cache lines so the two threads don't false-share.
+    alignas(64) std::atomic<size_t> m_Head;
+    size_t m_CachedTail = 0;    // Consumer's last view of m_Tail
+
+    alignas(64) std::atomic<size_t> m_Tail;
+    size_t m_CachedHead = 0;    // Producer's last view of m_Head
+};
@@ -0,0 +1,255 @@
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <string.h>
+
+// One direction of a shared-memory channel: a single-producer single-consumer byte ring.
+// It carries the ordinary wire format, so frames are decoded exactly as if they came
+// from a socket. Positions are free-running 32-bit counters masked into the ring.
+//
+// Neither side blocks on the ring. A consumer about to go idle sets 'readerWaiting'
+// and a producer that finds the ring full sets 'writerWaiting'; the other side clears
+// the flag and rings a doorbell (one byte on the connection's socket) so the sleeper's
+// poll wakes up. Under load the flags stay clear and no system call is made at all.
+class SharedRing
+{
+public:
+    struct Control
+    {
+        alignas(64) std::atomic<uint32_t> head;     // Written by the producer
+        alignas(64) std::atomic<uint32_t> tail;     // Written by the consumer
+        alignas(64) std::atomic<uint32_t> readerWaiting;
+        std::atomic<uint32_t> writerWaiting;
+    };
+
+    SharedRing()
+    {
+        m_Control = nullptr;
+        m_Data = nullptr;
+        m_Size = 0;
+    }
+
+    void Bind(Control* control, uint8_t* data, uint32_t size)
+    {
+        m_Control = control;
+        m_Data = data;
+        m_Size = size;
+    }
+
+    // Producer side. Copies as much of 'data' as fits and returns the byte count.
+    size_t Write(const void* data, size_t length)
+    {
+        uint32_t head = m_Control->head.load(std::memory_order_relaxed);
+        uint32_t used = head - m_Control->tail.load(std::memory_order_acquire);
+        if (used > m_Size)
+        {
+            return 0;   // Corrupted by the peer; never write outside the ring
+        }
+
+        size_t count = (std::min)(length, static_cast<size_t>(m_Size - used));
+        CopyIn(head, static_cast<const uint8_t*>(data), count);
+
+        m_Control->head.store(head + static_cast<uint32_t>(count), std::memory_order_seq_cst);
+        return count;
+    }
+
+    // Consumer side. Copies up to 'length' bytes out and returns the byte count.
+    size_t Read(void* data, size_t length)
+    {
+        uint32_t tail = m_Control->tail.load(std::memory_order_relaxed);
+        uint32_t available = m_Control->head.load(std::memory_order_acquire) - tail;
+        if (available > m_Size)
+        {
+            return 0;
+        }
+
+        size_t count = (std::min)(length, static_cast<size_t>(available));
+        CopyOut(tail, static_cast<uint8_t*>(data), count);
+
+        m_Control->tail.store(tail + static_cast<uint32_t>(count), std::memory_order_seq_cst);
+        return count;
+    }
+
+    // Ask the producer for a doorbell on its next write. Call Read() once more afterwards:
+    // bytes written before the flag became visible won't ring.
+    void SetReaderWaiting()
+    {
+        m_Control->readerWaiting.store(1, std::memory_order_seq_cst);
+    }
+
+    void SetWriterWaiting()
+    {
+        m_Control->writerWaiting.store(1, std::memory_order_seq_cst);
+    }
+
+    // True if the consumer asked for a doorbell; clears the request
+    bool TakeReaderWaiting()
+    {
+        return m_Control->readerWaiting.load(std::memory_order_seq_cst) != 0
+            && m_Control->readerWaiting.exchange(0) != 0;
+    }
+
+    bool TakeWriterWaiting()
+    {
+        return m_Control->writerWaiting.load(std::memory_order_seq_cst) != 0
+            && m_Control->writerWaiting.exchange(0) != 0;
+    }
+
+private:
+    void CopyIn(uint32_t position, const uint8_t* source, size_t count)
+    {
+        size_t offset = position & (m_Size - 1);
+        size_t first = (std::min)(count, m_Size - offset);
+        memcpy(m_Data + offset, source, first);
+        memcpy(m_Data, source + first, count - first);
+    }
+
+    void CopyOut(uint32_t position, uint8_t* target, size_t count)
+    {
+        size_t offset = position & (m_Size - 1);
+        size_t first = (std::min)(count, m_Size - offset);
+        memcpy(target, m_Data + offset, first);
+        memcpy(target + first, m_Data, count - first);
+    }
+
+    Control* m_Control;
+    uint8_t* m_Data;
+    uint32_t m_Size;
+};
+
+// A named shared-memory section holding two SharedRings, one per direction.
+// The server creates it for a local client that asked for one over its socket and
+// sends back the name; the client opens it. The socket stays open as the doorbell
+// and to detect either side going away.
+class SharedMemoryChannel
+{
+public:
+    static const uint32_t MAGIC = 0x43485231;   // "CHR1"
+
+    SharedMemoryChannel()
+    {
+        m_Mapping = NULL;
+        m_View = nullptr;
+    }
+
+    ~SharedMemoryChannel()
+    {
+        if (m_View != nullptr)
+        {
+            UnmapViewOfFile(m_View);
+        }
+        if (m_Mapping != NULL)
+        {
+            CloseHandle(m_Mapping);
+        }
+    }
+
+    SharedMemoryChannel(const SharedMemoryChannel&) = delete;
+    SharedMemoryChannel& operator=(const SharedMemoryChannel&) = delete;
+
+    // Server side. 'ringSize' is rounded up to a power of two.
+    bool Create(const std::string& name, uint32_t ringSize)
+    {
+        uint32_t size = 4096;
+        while (size < ringSize)
+        {
+            size <<= 1;
+        }
+
+        size_t total = DataOffset() + 2 * static_cast<size_t>(size);
+
+        SetLastError(0);
+        m_Mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, static_cast<DWORD>(total), name.c_str());
+        if (m_Mapping == NULL || GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            return false;
+        }
+
+        m_View = MapViewOfFile(m_Mapping, FILE_MAP_ALL_ACCESS, 0, 0, total);
+        if (m_View == nullptr)
+        {
+            return false;
+        }
+
+        Header* header = static_cast<Header*>(m_View);
+        for (SharedRing::Control& control : header->rings)
+        {
+            control.head.store(0, std::memory_order_relaxed);
+            control.tail.store(0, std::memory_order_relaxed);
+            control.readerWaiting.store(0, std::memory_order_relaxed);
+            control.writerWaiting.store(0, std::memory_order_relaxed);
+        }
+        header->ringSize = size;
+        header->magic = MAGIC;
+
+        Bind(true);
+        return true;
+    }
+
+    // Client side: open what the server created
+    bool Open(const std::string& name)
+    {
+        m_Mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+        if (m_Mapping == NULL)
+        {
+            return false;
+        }
+
+        m_View = MapViewOfFile(m_Mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        if (m_View == nullptr)
+        {
+            return false;
+        }
+
+        Header* header = static_cast<Header*>(m_View);
+        if (header->magic != MAGIC)
+        {
+            return false;
+        }
+
+        Bind(false);
+        return true;
+    }
+
+    // Bytes from the peer / to the peer
+    SharedRing& Inbound() { return m_Inbound; }
+    SharedRing& Outbound() { return m_Outbound; }
+
+private:
+    // rings[0] carries client -> server, rings[1] server -> client
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t ringSize;
+        SharedRing::Control rings[2];
+    };
+
+    static size_t DataOffset()
+    {
+        return (sizeof(Header) + 63) & ~static_cast<size_t>(63);
+    }
+
+    void Bind(bool server)
+    {
+        Header* header = static_cast<Header*>(m_View);
+        uint8_t* data = static_cast<uint8_t*>(m_View) + DataOffset();
+        uint32_t size = header->ringSize;
+
+        SharedRing& toServer = server ? m_Inbound : m_Outbound;
+        SharedRing& toClient = server ? m_Outbound : m_Inbound;
+        toServer.Bind(&header->rings[0], data, size);
+        toClient.Bind(&header->rings[1], data + size, size);
+    }
+
+    HANDLE m_Mapping;
+    void* m_View;
+    SharedRing m_Inbound;
+    SharedRing m_Outbound;
+};
@@ -10,178 +10,114 @@
 #include <conio.h>
 #include <future>
 #include <sstream>
+#include <thread>
+#include <chrono>
+#include <atomic>
 
-#include "Buffer.h"
 #include "Message.h"
+#include "MessageCodec.h"
+#include "SPSCQueue.h"
+#include "EventLoop.h"
+#include "ChatClient.h"
 
 #pragma comment(lib, "Ws2_32.lib")
 
 #define DEFAULT_PORT "8412"
 #define LOCAL_HOST_ADDR "127.0.0.1"
 
-SOCKET clientSocket;
+// Larger presence batches are summed up in one line instead of listing every member
+const size_t MAX_PRESENCE_LINES = 10;
 
-struct addrinfo* info = nullptr;
-struct addrinfo hints;
-
-std::vector<std::string> roomNames;
-
-bool isRunning = true;
-
-// Close the socket connection and clean up resources
-void closeSocketConnection() {
-    freeaddrinfo(info);
-    closesocket(clientSocket);
-    WSACleanup();
+// Print a connection error the same way for every scenario
+void handleError(std::string scenario, const ChatClient& client) {
+    std::cout << scenario << " failed. Error - " << client.LastError() << std::endl;
 }
 
-// Handle errors, clean memory if needed.
-void handleError(std::string scenario, bool freeMemoryOnError) {
-    int errorCode = WSAGetLastError();
-    if (errorCode == WSAEWOULDBLOCK) {
-        // No data available right now, continue the loop or do other work.
+// Append a single message to the pending console output
+void formatMessage(const ChatMessage& message, std::string& output) {
+    if (message.header.messageType == NOTIFICATION) {
+        output += message.message;
+        output += '\n';
     }
-    else if (errorCode == WSANOTINITIALISED) {
-        // WSA not yet initialized.
+    else if (message.header.messageType == TEXT) {
+        output += message.from;
+        output += ": ";
+        output += message.message;
+        output += '\n';
     }
-    else {
-        // Other errors here.
-        std::cout << scenario << " failed. Error - " << errorCode << std::endl;
-
-        // Close the socket if necessary.
-        if (freeMemoryOnError) {
-            closeSocketConnection();
-            freeaddrinfo(info);
-            WSACleanup();
-        }
-
+    else if (message.header.messageType == DIRECT) {
+        output += "[DM] ";
+        output += message.from;
+        output += ": ";
+        output += message.message;
+        output += '\n';
     }
-}
-
-// Prepare and send a chat message
-int sendMessage(const std::string& msg, const std::string& name, MESSAGE_TYPE type, SOCKET socket) {
-    ChatMessage message;
-    message.message = msg;
-    message.from = name;
-    message.messageLength = msg.length();
-    message.nameLength = name.length();
-    message.header.messageType = type;
-    message.header.packetSize = message.message.length() +
-        message.from.length() +
-        sizeof(message.messageLength) +
-        sizeof(message.header.messageType) +
-        sizeof(message.nameLength) +
-        sizeof(message.header.packetSize);
-
-    const int bufSize = 512;
-    Buffer buffer(bufSize);
-
-    // Write our packet to the buffer
-    buffer.WriteUInt32LE(message.header.packetSize);
-    buffer.WriteUInt32LE(message.header.messageType);
-    buffer.WriteUInt32LE(message.messageLength);
-    buffer.WriteUInt32LE(message.nameLength);
-    buffer.WriteString(message.message);
-    buffer.WriteString(message.from);
-
-    int result = send(socket, reinterpret_cast<const char*>(buffer.m_BufferData.data()), message.header.packetSize, 0);
-    if (result == SOCKET_ERROR) {
-        handleError("Send message", false);
-    }
-
-    return result;
-}
-
-
-// Join a chat room
-int joinRoom(std::string& name, std::string& selectedRoom, SOCKET& socket) {
-    std::string roomName;
-    std::istringstream ss(selectedRoom);
-
-    while (std::getline(ss, roomName, ',')) {
-        bool isDuplicate = false;
-        // Check if 'roomName' is not empty
-        if (!roomName.empty()) {
-            for (const std::string& existingRoom : roomNames) {
-                if (existingRoom == roomName) {
-                    isDuplicate = true;
-                    break;
-                }
-            }
-            if (!isDuplicate) {
-                roomNames.push_back(roomName);
+    else if (message.header.messageType == PRESENCE) {
+        PresenceMessage presence = MessageCodec::Decode<PresenceMessage>(message);
+        std::string room(presence.room);
+
+        size_t joined = 0;
+        size_t left = 0;
+        std::string lines;
+
+        std::istringstream ss{ std::string(presence.changes) };
+        std::string change;
+        while (std::getline(ss, change)) {
+            if (change.size() < 2) {
+                continue;
             }
+
+            bool isJoin = change[0] == '+';
+            (isJoin ? joined : left)++;
+            lines += change.substr(1) + (isJoin ? " has joined " : " has left ") + room + ".\n";
         }
-    }
 
-    int selectRoomResult = sendMessage(selectedRoom, name, JOIN_ROOM, socket);
-    if (selectRoomResult == SOCKET_ERROR) {
-        handleError("Join Room", false);
+        if (joined + left <= MAX_PRESENCE_LINES) {
+            output += lines;
+        }
+        else {
+            output += room + ": " + std::to_string(joined) + " joined, " + std::to_string(left) + " left.\n";
+        }
     }
-
-    return 0;
 }
 
-// Receive and process incoming chat messages
-void receiveMessages(SOCKET socket) {
-    const int bufSize = 512;
-    Buffer buffer(bufSize);
-
-    // Call recv function to get data
-    int result = recv(socket, reinterpret_cast<char*>(buffer.m_BufferData.data()), bufSize, 0);
-    if (result == SOCKET_ERROR) {
-        handleError("Receive Data", false);
-        return;
-    }
-
-    // Check and process if result contains any data.
-    if (result > 0) {
-        uint32_t packetSize = buffer.ReadUInt32LE();
-        uint32_t messageType = buffer.ReadUInt32LE();
+// Drain the inbox once per render tick and write everything in a single console write,
+// so a busy room costs one flush per tick instead of one per message.
+// 'dropped' counts messages that arrived while the inbox was full; they are reported as one line.
+void renderMessages(const ChatClient& client, SPSCQueue<ChatMessage>& inbox, std::atomic<size_t>& dropped) {
+    const auto renderTick = std::chrono::milliseconds(16);
 
-        if (messageType == NOTIFICATION) {
-            uint32_t messageLength = buffer.ReadUInt32LE();
-            uint32_t nameLength = buffer.ReadUInt32LE();
+    std::string output;
+    ChatMessage message;
 
-            std::string msg = buffer.ReadString(messageLength);
+    for (;;) {
+        // Sample the state before draining, so nothing queued before Close() is lost.
+        bool closed = client.State() == ConnectionState::Closed;
 
-            std::cout << "\r";
-            std::cout << msg;
-            std::cout.flush();
+        output.clear();
 
-            std::cout << "\nYou: ";
+        while (inbox.TryPop(message)) {
+            formatMessage(message, output);
         }
-        else if (messageType == TEXT) {
-            uint32_t messageLength = buffer.ReadUInt32LE();
-            uint32_t nameLength = buffer.ReadUInt32LE();
-            std::string msg = buffer.ReadString(messageLength);
-            std::string name = buffer.ReadString(nameLength);
-
-            std::cout << "\r";
-            std::cout << name << ": " << msg;
-            std::cout.flush();
 
-            std::cout << "\nYou: ";
+        size_t droppedNow = dropped.exchange(0, std::memory_order_relaxed);
+        if (droppedNow > 0) {
+            output += std::to_string(droppedNow) + " messages dropped, the display could not keep up.\n";
         }
-    }
-}
 
-// Send a leave room message
-void sendLeaveMessage(std::string name, std::string roomName, SOCKET socket) {
-    if (!roomName.empty()) {
-        // Search for 'roomName' in 'roomNames'
-        auto it = std::find(roomNames.begin(), roomNames.end(), roomName);
+        if (!output.empty()) {
+            std::cout << "\r" << output << "You: ";
+            std::cout.flush();
+        }
 
-        if (it != roomNames.end()) {
-            // 'roomName' exists, remove it
-            roomNames.erase(it);
+        if (closed) {
+            return;
         }
-    }
 
-    sendMessage(roomName, name, LEAVE_ROOM, socket);
+        std::this_thread::sleep_for(renderTick);
+    }
 }
 
-
 // Print a horizontal line as a separator
 void printLine() {
     printf("\n-------------------------------------\n");
@@ -212,31 +148,54 @@ int main() {
         return 1;
     }
 
-    struct addrinfo* info = nullptr;
-    struct addrinfo hints;
+    EventLoop loop;
+    if (!loop.Start()) {
+        printf("\nEvent loop failed to start with error %d", WSAGetLastError());
+        WSACleanup();
+        return 1;
+    }
 
-    ZeroMemory(&hints, sizeof(hints));      // Ensure we don't have garbage data
-    hints.ai_family = AF_INET;              // IPv4
-    hints.ai_socktype = SOCK_STREAM;        // Stream
-    hints.ai_protocol = IPPROTO_TCP;        // TCP
-    hints.ai_flags = AI_PASSIVE;
+    // Incoming messages flow: event loop thread -> inbox -> renderThread -> console
+    SPSCQueue<ChatMessage> inbox(16 * 1024);
+    std::atomic<size_t> dropped(0);
+    std::promise<bool> connected;
 
-    // Getting addr info
-    result = getaddrinfo(LOCAL_HOST_ADDR, DEFAULT_PORT, &hints, &info);
-    if (result == SOCKET_ERROR) {
-        handleError("GetAddrInfo", true);
-    }
+    std::shared_ptr<ChatClient> client = ChatClient::Create(loop);
 
-    // Socket
-    clientSocket = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
-    if (clientSocket == INVALID_SOCKET) {
-        handleError("Socket initialization", true);
-    }
+    client->OnMessage([&inbox, &dropped](const ChatMessage& message) {
+        // Never wait for the renderer here: this runs on the event loop thread, and blocking
+        // it would stall every socket on the loop. If the renderer falls behind, drop and count.
+        if (!inbox.TryPush(ChatMessage(message))) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    bool connectReported = false;   // Only touched on the event loop thread
+
+    client->OnStateChanged([&](ConnectionState state, int errorCode) {
+        if (!connectReported) {
+            connectReported = true;
+            connected.set_value(state == ConnectionState::Connected);
+        }
+        else if (state == ConnectionState::Closed && errorCode != 0) {
+            ChatMessage notice;
+            notice.header.messageType = NOTIFICATION;
+            notice.message = "Disconnected from the server.";
+            if (!inbox.TryPush(std::move(notice))) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    });
 
     // Connect
-    result = connect(clientSocket, info->ai_addr, static_cast<int>(info->ai_addrlen));
-    if (result == SOCKET_ERROR) { // Fixed the condition here
-        handleError("Socket connection", true);
+    bool isConnected = client->Connect(LOCAL_HOST_ADDR, DEFAULT_PORT)
+        && connected.get_future().get();
+
+    if (!isConnected) {
+        handleError("Socket connection", *client);
+        loop.Stop();
+        WSACleanup();
+        return 1;
     }
 
     printf("Connected to the server successfully!");
@@ -254,60 +213,63 @@ int main() {
     std::cout << "Enter an existing room name or create a new room: ";
     std::getline(std::cin, selectedRoom);
 
-    result = joinRoom(name, selectedRoom, clientSocket);
-    if (result != 0) {
+    if (!client->JoinRooms(name, selectedRoom)) {
         printf("\nJoining Room Failed.\n");
     }
 
     printf("\n\n*** Type a message and press 'Enter' to send ***");
-    printf("\n*** Type 'exit' to quit, '\LR ROOM_NAME' to leave room ***\n\n");
+    printf("\n*** Type 'exit' to quit, '\\LR ROOM_NAME' to leave room ***");
+    printf("\n*** Type '\\DM NAME MESSAGE' to message one user directly ***\n\n");
 
-    // Create a separate thread for receiving messages
-    std::thread receiveThread([&] {
-        while (isRunning) {
-            receiveMessages(clientSocket);
-        }
+    std::thread renderThread([&] {
+        renderMessages(*client, inbox, dropped);
     });
 
-    while (isRunning) {
+    while (client->IsOpen()) {
         std::string message;
         std::cout << "You: ";
         std::getline(std::cin, message);
 
         if (message == "exit") {
-            for (const std::string& roomName : roomNames) {
-                sendLeaveMessage(name, roomName, clientSocket);
+            for (const std::string& roomName : client->Rooms()) {
+                client->LeaveRoom(name, roomName);
             }
-            isRunning = false;
             break;
         }
 
         if (message.compare(0, 3, "\\LR") == 0) {
-            if (roomNames.size() > 0) {
+            if (client->Rooms().size() > 0) {
                 std::string roomName = message.substr(4);
-                sendLeaveMessage(name, roomName, clientSocket);
+                client->LeaveRoom(name, roomName);
 
-                if (roomNames.size() == 0) {
-                    isRunning = false;
+                if (client->Rooms().size() == 0) {
                     break;
                 }
             }
         }
+        else if (message.compare(0, 3, "\\DM") == 0) {
+            // \DM NAME MESSAGE
+            size_t nameEnd = message.find(' ', 4);
+            if (message.size() < 5 || nameEnd == std::string::npos) {
+                printf("Usage: \\DM NAME MESSAGE\n");
+            }
+            else if (!client->SendDirect(message.substr(4, nameEnd - 4), message.substr(nameEnd + 1))) {
+                handleError("Send message", *client);
+            }
+        }
         else if (!message.empty()) {
-            sendMessage(message, name, TEXT, clientSocket);
+            if (!client->Send(message, name, TEXT)) {
+                handleError("Send message", *client);
+            }
         }
     }
 
-    if (isRunning) {
-        receiveThread.join();
-    }
-    else {
-        receiveThread.detach();
-    }
+    // Flushes the queued leave messages, then stops the I/O thread
+    client->Close();
+    loop.Stop();
+    renderThread.join();
 
     // Close
-    freeaddrinfo(info);
-    closesocket(clientSocket);
     WSACleanup();
 
     return 0;
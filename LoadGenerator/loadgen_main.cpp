@@ -0,0 +1,440 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <Windows.h>
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Message.h"
+#include "EventLoop.h"
+#include "ChatClient.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+
+#define DEFAULT_PORT "8412"
+#define LOCAL_HOST_ADDR "127.0.0.1"
+
+typedef std::chrono::steady_clock Clock;
+
+// Command line options
+struct LoadConfig {
+    std::string host = LOCAL_HOST_ADDR;
+    std::string port = DEFAULT_PORT;
+    std::vector<std::string> servers;   // host:port list; client i connects to servers[i % n]
+    std::string localPath;      // Connect over this AF_UNIX socket instead of TCP
+    bool sharedMemory = false;  // ...and move the frames onto a shared-memory ring
+    int clients = 100;          // Connections to open
+    int rooms = 10;             // Client i joins room "load<i % rooms>"
+    int loops = 1;              // Event loop threads the connections are spread over
+    double rate = 10.0;         // Messages per second per client
+    int duration = 10;          // Seconds of sending
+    int payloadSize = 64;       // Bytes per message, including the timestamp
+    int flooders = 0;           // Extra abusive clients in room "load0"
+    double floodRate = 5000.0;  // Messages per second per abusive client
+    int stormClients = 0;       // Extra clients that all connect a third of the way in, then all reconnect
+
+    // Empty: clients talk in shared rooms. Otherwise each message goes to one random other
+    // client, as a DIRECT message ("direct") or, the old way, by stepping into the target's
+    // one-person room for the message ("rooms"). Client i sits in room "inbox<i>" either way.
+    std::string directMode;
+};
+
+// Per-event-loop results; only written from that loop's thread
+struct LoopStats {
+    std::vector<uint32_t> latenciesUs;  // Well-behaved senders only
+    uint64_t received = 0;
+    uint64_t floodReceived = 0;
+    uint64_t presenceFrames = 0;        // Received by the well-behaved clients
+    uint64_t presenceBytes = 0;
+    uint64_t stormPresenceFrames = 0;   // Received by the storm clients
+};
+
+void printUsage() {
+    printf("Usage: LoadGenerator [options]\n");
+    printf("  --host ADDR       server address (default %s)\n", LOCAL_HOST_ADDR);
+    printf("  --port PORT       server port (default %s)\n", DEFAULT_PORT);
+    printf("  --servers LIST    spread clients over host:port,host:port,... (client ports of cluster nodes)\n");
+    printf("  --unix PATH       connect over the server's AF_UNIX socket instead of TCP\n");
+    printf("  --shm             with --unix, use a shared-memory ring per client\n");
+    printf("  --clients N       connections to open (default 100)\n");
+    printf("  --rooms N         rooms to spread clients over (default 10)\n");
+    printf("  --loops N         event loop threads (default 1)\n");
+    printf("  --rate N          messages per second per client (default 10)\n");
+    printf("  --duration N      seconds to send for (default 10)\n");
+    printf("  --size N          payload bytes per message (default 64)\n");
+    printf("  --flood N         extra clients flooding room load0 (default 0)\n");
+    printf("  --flood-rate N    messages per second per flooding client (default 5000)\n");
+    printf("  --storm N         extra clients that join all at once a third of the way in,\n");
+    printf("                    then all disconnect and reconnect at two thirds (default 0)\n");
+    printf("  --dm MODE         send every message to one random client: 'direct' uses DIRECT\n");
+    printf("                    messages, 'rooms' joins the target's one-person room to send\n");
+}
+
+// Returns false on an unknown option
+bool parseArgs(int argc, char** argv, LoadConfig& config) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        // The only option without a value
+        if (arg == "--shm") {
+            config.sharedMemory = true;
+            continue;
+        }
+
+        if (value == nullptr) {
+            return false;
+        }
+
+        if (arg == "--host") config.host = value;
+        else if (arg == "--port") config.port = value;
+        else if (arg == "--servers") {
+            std::istringstream ss(value);
+            std::string server;
+            while (std::getline(ss, server, ',')) {
+                if (server.rfind(':') == std::string::npos) {
+                    return false;
+                }
+                config.servers.push_back(server);
+            }
+        }
+        else if (arg == "--unix") config.localPath = value;
+        else if (arg == "--clients") config.clients = atoi(value);
+        else if (arg == "--rooms") config.rooms = atoi(value);
+        else if (arg == "--loops") config.loops = atoi(value);
+        else if (arg == "--rate") config.rate = atof(value);
+        else if (arg == "--duration") config.duration = atoi(value);
+        else if (arg == "--size") config.payloadSize = atoi(value);
+        else if (arg == "--flood") config.flooders = atoi(value);
+        else if (arg == "--flood-rate") config.floodRate = atof(value);
+        else if (arg == "--storm") config.stormClients = atoi(value);
+        else if (arg == "--dm") config.directMode = value;
+        else return false;
+
+        i++;
+    }
+
+    if (config.servers.empty()) {
+        config.servers.push_back(config.host + ":" + config.port);
+    }
+
+    if (config.sharedMemory && config.localPath.empty()) {
+        return false;
+    }
+
+    if (!config.directMode.empty() && (config.clients < 2 || (config.directMode != "direct" && config.directMode != "rooms"))) {
+        return false;
+    }
+
+    return config.clients > 0 && config.rooms > 0 && config.loops > 0 && config.rate > 0
+        && config.flooders >= 0 && config.floodRate > 0 && config.stormClients >= 0;
+}
+
+// Start connecting client number 'index' to its server, over TCP or the local socket
+bool connectClient(ChatClient& client, const LoadConfig& config, int index) {
+    if (!config.localPath.empty()) {
+        return client.ConnectLocal(config.localPath.c_str(), config.sharedMemory);
+    }
+
+    const std::string& server = config.servers[index % config.servers.size()];
+    size_t colon = server.rfind(':');
+    std::string host = server.substr(0, colon);
+    std::string port = server.substr(colon + 1);
+    return client.Connect(host.c_str(), port.c_str());
+}
+
+uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// Payload starts with the send timestamp so every receiver can compute end-to-end latency
+std::string makePayload(int size) {
+    std::string payload = std::to_string(nowNs());
+    payload.push_back('|');
+    if (static_cast<int>(payload.size()) < size) {
+        payload.append(size - payload.size(), 'x');
+    }
+    return payload;
+}
+
+uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+    return sorted[index];
+}
+
+// Print a horizontal line as a separator
+void printLine() {
+    printf("\n-------------------------------------\n");
+}
+
+int main(int argc, char** argv) {
+    LoadConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        printUsage();
+        return 1;
+    }
+
+    // Initialize WinSock
+    WSADATA wsaData;
+    int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (result != 0) {
+        printf("WSAStartup failed with error %d\n", result);
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    std::vector<LoopStats> stats(config.loops);
+
+    for (int i = 0; i < config.loops; i++) {
+        loops.emplace_back(new EventLoop());
+        if (!loops.back()->Start()) {
+            printf("Event loop failed to start with error %d\n", WSAGetLastError());
+            return 1;
+        }
+    }
+
+    std::atomic<int> connected(0);
+    std::atomic<int> failed(0);
+    std::vector<std::shared_ptr<ChatClient>> clients;
+
+    int totalClients = config.clients + config.flooders;
+
+    // Clients [0, clients) are well-behaved; the flooders come after them
+    for (int i = 0; i < totalClients; i++) {
+        bool flooder = i >= config.clients;
+        int loopIndex = i % config.loops;
+        std::shared_ptr<ChatClient> client = ChatClient::Create(*loops[loopIndex]);
+        LoopStats& loopStats = stats[loopIndex];
+
+        client->OnMessage([&loopStats](const ChatMessage& message) {
+            if (message.header.messageType == PRESENCE) {
+                loopStats.presenceFrames++;
+                loopStats.presenceBytes += message.header.packetSize;
+                return;
+            }
+
+            if (message.header.messageType != TEXT && message.header.messageType != DIRECT) {
+                return;
+            }
+
+            // Only the well-behaved traffic is measured; the flood is what it has to survive
+            if (message.from.compare(0, 5, "flood") == 0) {
+                loopStats.floodReceived++;
+                return;
+            }
+
+            loopStats.received++;
+            uint64_t sentNs = strtoull(message.message.c_str(), nullptr, 10);
+            if (sentNs != 0) {
+                loopStats.latenciesUs.push_back(static_cast<uint32_t>((nowNs() - sentNs) / 1000));
+            }
+        });
+
+        client->OnStateChanged([&connected, &failed](ConnectionState state, int errorCode) {
+            if (state == ConnectionState::Connected) {
+                connected++;
+            }
+            else if (state == ConnectionState::Closed && errorCode != 0) {
+                failed++;
+            }
+        });
+
+        // Connect and join are pipelined: the join is queued before the TCP handshake completes.
+        std::string name = flooder ? "flood" + std::to_string(i - config.clients) : "bot" + std::to_string(i);
+        std::string room = flooder ? "load0" : "load" + std::to_string(i % config.rooms);
+        if (!flooder && !config.directMode.empty()) {
+            room = "inbox" + std::to_string(i);
+        }
+        if (!connectClient(*client, config, i) || !client->JoinRooms(name, room)) {
+            failed++;
+        }
+
+        clients.push_back(client);
+    }
+
+    // Wait for every handshake to finish one way or the other
+    auto setupDeadline = Clock::now() + std::chrono::seconds(30);
+    while (connected + failed < totalClients && Clock::now() < setupDeadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    printLine();
+    printf("Connected %d / %d clients (%d failed)", connected.load(), totalClients, failed.load());
+    printLine();
+
+    // Give the server a moment to process the joins before measuring
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    // Storm clients only count what they receive; their joins and leaves are the load
+    std::vector<std::shared_ptr<ChatClient>> storm;
+    auto startStorm = [&]() {
+        for (int i = 0; i < config.stormClients; i++) {
+            int loopIndex = i % config.loops;
+            LoopStats& loopStats = stats[loopIndex];
+            std::shared_ptr<ChatClient> client = ChatClient::Create(*loops[loopIndex]);
+            client->OnMessage([&loopStats](const ChatMessage& message) {
+                if (message.header.messageType == PRESENCE) {
+                    loopStats.stormPresenceFrames++;
+                }
+            });
+
+            std::string name = "storm" + std::to_string(i);
+            std::string room = "load" + std::to_string(i % config.rooms);
+            if (connectClient(*client, config, i)) {
+                client->JoinRooms(name, room);
+            }
+            storm.push_back(client);
+        }
+    };
+    int stormWave = 0;
+
+    // Pace sends on a 1ms tick: each tick catches up to where the schedule says we should be.
+    uint64_t totalPlanned = static_cast<uint64_t>(config.rate * config.clients * config.duration);
+    uint64_t sent = 0;
+    uint64_t dropped = 0;
+    size_t nextClient = 0;
+    uint32_t targetSeed = 12345;
+
+    uint64_t floodPlanned = static_cast<uint64_t>(config.floodRate * config.flooders * config.duration);
+    uint64_t floodSent = 0;
+    uint64_t floodDropped = 0;
+    int nextFlooder = 0;
+
+    auto start = Clock::now();
+    auto end = start + std::chrono::seconds(config.duration);
+
+    while (Clock::now() < end) {
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+        if (config.stormClients > 0 && stormWave == 0 && elapsed >= config.duration / 3.0) {
+            startStorm();
+            stormWave = 1;
+        }
+        else if (stormWave == 1 && elapsed >= config.duration * 2.0 / 3.0) {
+            // Everyone drops and comes straight back, as after a network blip
+            for (std::shared_ptr<ChatClient>& client : storm) {
+                client->Close();
+            }
+            storm.clear();
+            startStorm();
+            stormWave = 2;
+        }
+
+        uint64_t due = (std::min)(totalPlanned, static_cast<uint64_t>(elapsed * config.rate * config.clients));
+
+        while (sent + dropped < due) {
+            std::string name = "bot" + std::to_string(nextClient);
+            std::shared_ptr<ChatClient>& client = clients[nextClient];
+            size_t sender = nextClient;
+            nextClient = (nextClient + 1) % config.clients;
+
+            bool queued;
+            if (config.directMode.empty()) {
+                queued = client->Send(makePayload(config.payloadSize), name, TEXT);
+            }
+            else {
+                // Any client but the sender
+                targetSeed = targetSeed * 1103515245 + 12345;
+                size_t target = (sender + 1 + (targetSeed >> 8) % (config.clients - 1)) % config.clients;
+
+                if (config.directMode == "direct") {
+                    queued = client->SendDirect("bot" + std::to_string(target), makePayload(config.payloadSize));
+                }
+                else {
+                    // A TEXT goes to every room the sender is in, so step in, speak, step out
+                    std::string room = "inbox" + std::to_string(target);
+                    queued = client->JoinRooms(name, room)
+                        && client->Send(makePayload(config.payloadSize), name, TEXT)
+                        && client->LeaveRoom(name, room);
+                }
+            }
+
+            if (queued) {
+                sent++;
+            }
+            else {
+                dropped++;
+            }
+        }
+
+        uint64_t floodDue = (std::min)(floodPlanned, static_cast<uint64_t>(elapsed * config.floodRate * config.flooders));
+
+        while (floodSent + floodDropped < floodDue) {
+            std::string name = "flood" + std::to_string(nextFlooder);
+            std::shared_ptr<ChatClient>& client = clients[config.clients + nextFlooder];
+            nextFlooder = (nextFlooder + 1) % config.flooders;
+
+            if (client->Send(makePayload(config.payloadSize), name, TEXT)) {
+                floodSent++;
+            }
+            else {
+                floodDropped++;
+            }
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    double sendSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Let in-flight messages drain, then stop the loops so the stats are stable to read.
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    for (std::unique_ptr<EventLoop>& loop : loops) {
+        loop->Stop();
+    }
+
+    std::vector<uint32_t> latencies;
+    uint64_t received = 0;
+    uint64_t floodReceived = 0;
+    uint64_t presenceFrames = 0;
+    uint64_t presenceBytes = 0;
+    uint64_t stormPresenceFrames = 0;
+    for (const LoopStats& loopStats : stats) {
+        received += loopStats.received;
+        floodReceived += loopStats.floodReceived;
+        presenceFrames += loopStats.presenceFrames;
+        presenceBytes += loopStats.presenceBytes;
+        stormPresenceFrames += loopStats.stormPresenceFrames;
+        latencies.insert(latencies.end(), loopStats.latenciesUs.begin(), loopStats.latenciesUs.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("Sent            : %llu (%llu not queued)\n", (unsigned long long)sent, (unsigned long long)dropped);
+    printf("Received        : %llu\n", (unsigned long long)received);
+    printf("Send rate       : %.0f msg/s\n", sent / sendSeconds);
+    printf("Delivery rate   : %.0f msg/s\n", received / sendSeconds);
+    printf("Latency p50     : %u us\n", percentile(latencies, 0.50));
+    printf("Latency p99     : %u us\n", percentile(latencies, 0.99));
+    printf("Latency p99.9   : %u us\n", percentile(latencies, 0.999));
+    printf("Latency max     : %u us\n", latencies.empty() ? 0 : latencies.back());
+
+    if (config.flooders > 0) {
+        printf("Flood sent      : %llu (%llu not queued)\n", (unsigned long long)floodSent, (unsigned long long)floodDropped);
+        printf("Flood delivered : %llu\n", (unsigned long long)floodReceived);
+    }
+
+    printf("Presence frames : %llu (%llu bytes)\n", (unsigned long long)presenceFrames, (unsigned long long)presenceBytes);
+
+    if (config.stormClients > 0) {
+        printf("Storm presence  : %llu frames\n", (unsigned long long)stormPresenceFrames);
+    }
+
+    WSACleanup();
+
+    return 0;
+}
@@ -0,0 +1,1146 @@
+#include "ChatServer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+	// New connections accepted per readiness event on the listen socket
+	const int MAX_ACCEPTS_PER_EVENT = 64;
+
+	// How often the throttle counters are printed, when they changed
+	const auto COUNTER_REPORT_INTERVAL = std::chrono::seconds(10);
+
+	// Cluster links carry many clients' traffic, so they get a bigger share of each turn
+	const size_t PEER_TURN_QUANTUM = 1024 * 1024;
+
+	const auto PEER_RECONNECT_DELAY = std::chrono::milliseconds(1000);
+
+	// A room's presence changes are split into frames of at most this size, well under the packet limit
+	const size_t PRESENCE_FRAME_BYTES = 32 * 1024;
+
+	// How long a node remembers which rooms of a split broadcast it already delivered. The
+	// parts from each owner arrive over different links, but well within this.
+	const auto SPLIT_BROADCAST_WINDOW = std::chrono::seconds(10);
+
+	// Longest "<origin node>:<broadcast id>:" in front of a route header's room list
+	const size_t MAX_ROUTE_PREFIX = 2 * 20 + 2;
+
+	// Largest text and name accepted when --max-text or --max-name is 0 or higher than this.
+	// Every frame built around them must fit in MessageCodec::MAX_PACKET_SIZE: a TEXT frame
+	// goes to other nodes with one of its rooms (room lists count as text) in the header, a
+	// forwarded DIRECT frame carries both names, and a presence line holds one name.
+	const size_t MAX_TEXT_BYTES = 30 * 1024;
+	const size_t MAX_NAME_BYTES = 1024;
+
+	static_assert(3 * MessageCodec::HEADER_SIZE + 2 * MAX_TEXT_BYTES + MAX_NAME_BYTES + MAX_ROUTE_PREFIX <= MessageCodec::MAX_PACKET_SIZE,
+		"A routed TEXT frame must fit in one packet");
+	static_assert(MessageCodec::HEADER_SIZE + MAX_TEXT_BYTES + MAX_NAME_BYTES + 2 <= PRESENCE_FRAME_BYTES,
+		"A presence frame must have room for one line in any room");
+	static_assert(2 * MessageCodec::HEADER_SIZE + PRESENCE_FRAME_BYTES + MAX_TEXT_BYTES + MAX_ROUTE_PREFIX <= MessageCodec::MAX_PACKET_SIZE,
+		"A routed presence frame must fit in one packet");
+
+	// How often mailboxes past their time to live are looked for
+	const auto MAILBOX_EXPIRY_INTERVAL = std::chrono::seconds(1);
+
+	std::string nameInUseNotice(std::string_view name) {
+		return "The name " + std::string(name) + " is already in use. Direct messages go to the other connection until it leaves.";
+	}
+
+	// View a broadcast frame as the bytes carried inside a cluster frame
+	std::string_view frameBytes(const std::vector<uint8_t>& frame) {
+		return std::string_view(reinterpret_cast<const char*>(frame.data()), frame.size());
+	}
+
+	// Remove 'node' from a room's member nodes
+	void removeNode(std::vector<int>& nodes, int node) {
+		auto it = std::find(nodes.begin(), nodes.end(), node);
+		if (it != nodes.end()) {
+			*it = nodes.back();
+			nodes.pop_back();
+		}
+	}
+
+	// Remove 'value' from 'list', keeping the rest in order
+	template <typename T>
+	bool eraseOrdered(std::vector<T>& list, const T& value) {
+		auto it = std::find(list.begin(), list.end(), value);
+		if (it == list.end()) {
+			return false;
+		}
+
+		list.erase(it);
+		return true;
+	}
+
+	// Remove 'session' from a client list; order within a room doesn't matter
+	bool removeClient(std::vector<Session*>& clients, Session* session) {
+		auto it = std::find(clients.begin(), clients.end(), session);
+		if (it == clients.end()) {
+			return false;
+		}
+
+		*it = clients.back();
+		clients.pop_back();
+		return true;
+	}
+}
+
+ChatServer::ChatServer(Reactor& reactor, SOCKET listenSocket, const ServerConfig& config)
+	: m_Reactor(reactor)
+	, m_ListenSocket(listenSocket)
+	, m_Config(config)
+	, m_ChannelCounter(0)
+	, m_MailboxBytes(0)
+	, m_BroadcastEpoch(0)
+	, m_ClusterBroadcastId(0)
+	, m_Ring((std::max)(static_cast<int>(config.nodes.size()), 1))
+	, m_Peers(config.nodes.size(), nullptr)
+	, m_NodeRooms(config.nodes.size()) {
+	u_long nonBlocking = 1;
+	ioctlsocket(m_ListenSocket, FIONBIO, &nonBlocking);
+
+	if (m_Config.maxTextBytes == 0 || m_Config.maxTextBytes > MAX_TEXT_BYTES) {
+		m_Config.maxTextBytes = MAX_TEXT_BYTES;
+	}
+	if (m_Config.maxNameBytes == 0 || m_Config.maxNameBytes > MAX_NAME_BYTES) {
+		m_Config.maxNameBytes = MAX_NAME_BYTES;
+	}
+
+	m_Filter.Configure(m_Config.maxTextBytes, m_Config.maxNameBytes, m_Config.bannedTerms);
+	printf("Content filter: %s, %zu banned terms\n", ContentFilter::KernelName(m_Filter.GetKernel()), m_Filter.TermCount());
+
+	m_Reactor.Register(this);
+	m_Reactor.AddTimer(COUNTER_REPORT_INTERVAL, [this] { ReportCounters(); });
+
+	if (m_Config.presenceWindow.count() > 0) {
+		m_Reactor.AddTimer(m_Config.presenceWindow, [this] { FlushPresence(); });
+	}
+
+	if (m_Config.mailboxTtl.count() > 0) {
+		m_Reactor.AddTimer(MAILBOX_EXPIRY_INTERVAL, [this] { ExpireMailboxes(); });
+	}
+}
+
+ChatServer::~ChatServer() {
+	m_Reactor.Unregister(this);
+}
+
+void ChatServer::ListenLocal(SOCKET localSocket) {
+	m_LocalListener.reset(new Listener(*this, m_Reactor, localSocket, Endpoint::Local));
+}
+
+void ChatServer::ListenCluster(SOCKET clusterSocket) {
+	m_ClusterListener.reset(new Listener(*this, m_Reactor, clusterSocket, Endpoint::Cluster));
+}
+
+void ChatServer::CreateRooms() {
+	std::string gameroom = "games";
+	std::string studyroom = "study";
+	std::string newsroom = "news";
+
+	GetRoom(gameroom);
+	GetRoom(studyroom);
+	GetRoom(newsroom);
+
+	printf("%s .... Room Created\n", gameroom.c_str());
+	printf("%s .... Room Created\n", studyroom.c_str());
+	printf("%s .... Room Created\n", newsroom.c_str());
+}
+
+bool ChatServer::StartCluster() {
+	if (!IsClustered()) {
+		return true;
+	}
+
+	// Resolve every node up front: the lower ones are dialed, the higher ones are only
+	// accepted from their own address
+	m_NodeAddresses.resize(m_Config.nodes.size());
+	for (size_t node = 0; node < m_Config.nodes.size(); node++) {
+		const std::string& endpoint = m_Config.nodes[node];
+		size_t colon = endpoint.rfind(':');
+		if (colon == std::string::npos) {
+			printf("Invalid cluster node address: %s\n", endpoint.c_str());
+			return false;
+		}
+
+		std::string host = endpoint.substr(0, colon);
+		std::string port = endpoint.substr(colon + 1);
+
+		struct addrinfo hints;
+		ZeroMemory(&hints, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_TCP;
+
+		struct addrinfo* info = nullptr;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &info) != 0 || info == nullptr) {
+			printf("Could not resolve cluster node %s\n", endpoint.c_str());
+			return false;
+		}
+
+		memcpy(&m_NodeAddresses[node], info->ai_addr, sizeof(sockaddr_in));
+		freeaddrinfo(info);
+	}
+
+	// Node i dials every node below it and accepts from every node above, so each pair
+	// ends up with exactly one link.
+	for (int node = 0; node < m_Config.nodeId; node++) {
+		DialPeer(node);
+	}
+
+	printf("Cluster node %d of %d\n", m_Config.nodeId, (int)m_Config.nodes.size());
+	return true;
+}
+
+void ChatServer::OnPollEvents(short revents) {
+	AcceptConnections(m_ListenSocket, Endpoint::Tcp);
+}
+
+void ChatServer::AcceptConnections(SOCKET listenSocket, Endpoint endpoint) {
+	for (int i = 0; i < MAX_ACCEPTS_PER_EVENT; i++) {
+		sockaddr_storage address;
+		int addressLength = sizeof(address);
+		SOCKET newConnection = accept(listenSocket, reinterpret_cast<sockaddr*>(&address), &addressLength);
+		if (newConnection == INVALID_SOCKET) {
+			int errorCode = WSAGetLastError();
+			if (errorCode != WSAEWOULDBLOCK) {
+				printf("accept failed with error: %d\n", errorCode);
+			}
+			return;
+		}
+
+		u_long nonBlocking = 1;
+		ioctlsocket(newConnection, FIONBIO, &nonBlocking);
+
+		// Sessions already coalesce everything queued in a turn into one send()
+		if (endpoint != Endpoint::Local) {
+			BOOL noDelay = TRUE;
+			setsockopt(newConnection, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+		}
+
+		// Runs until the handler's first co_await, then comes straight back here
+		if (endpoint == Endpoint::Cluster) {
+			sockaddr_in peerAddress;
+			memcpy(&peerAddress, &address, sizeof(peerAddress));
+			HandlePeer(newConnection, peerAddress);
+		}
+		else {
+			HandleClient(newConnection, endpoint == Endpoint::Local);
+		}
+	}
+}
+
+DetachedTask ChatServer::HandleClient(SOCKET socket, bool local) {
+	Session session(m_Reactor, socket, m_Config.turnQuantum);
+	session.m_TextLimit.Configure(m_Config.sessionRate, m_Config.sessionBurst, m_Reactor.Now());
+	printf("Client connected with Socket: %d\n", (int)socket);
+
+	ChatMessage message;
+
+	// The first frame must be the JOIN_ROOM handshake, optionally preceded by a local
+	// client's SHM_ATTACH. Waiting for it suspends only this connection; everyone else
+	// keeps being served.
+	if (!co_await session.ReadFrame(message)) {
+		co_return;
+	}
+
+	if (message.header.messageType == SHM_ATTACH) {
+		if (!local || !m_Config.sharedMemory) {
+			printf("Client with Socket %d asked for shared memory, disconnecting\n", (int)socket);
+			co_return;
+		}
+
+		std::string name = "Local\\ChatServer-" + std::to_string(GetCurrentProcessId()) + "-" + std::to_string(m_ChannelCounter++);
+		std::unique_ptr<SharedMemoryChannel> channel(new SharedMemoryChannel());
+		if (!channel->Create(name, m_Config.ringSize)) {
+			printf("Shared memory channel %s failed with error %d\n", name.c_str(), (int)GetLastError());
+			co_return;
+		}
+
+		// The reply is the last frame on the socket; the client opens the channel when it sees it
+		session.Enqueue(MessageCodec::Encode(ShmAttachMessage{ name }));
+		if (!co_await session.Flush()) {
+			co_return;
+		}
+		session.AttachChannel(std::move(channel));
+
+		if (!co_await session.ReadFrame(message)) {
+			co_return;
+		}
+	}
+
+	if (message.header.messageType != JOIN_ROOM) {
+		printf("Client with Socket %d did not join a room, disconnecting\n", (int)socket);
+		co_return;
+	}
+
+	JoinRoomMessage join = MessageCodec::Decode<JoinRoomMessage>(message);
+	if (!AdmitContent(session, join.rooms, join.name, "join")) {
+		co_await session.Flush();
+		co_return;
+	}
+
+	session.m_Name = join.name;
+	ScopeExit leave([&] {
+		LeaveAllRooms(session);
+		UnregisterUser(session);
+	});
+	JoinRooms(session, join.rooms);
+	RegisterUser(session);
+
+	ClientHandler handler{ *this, session };
+	while (co_await session.ReadFrame(message)) {
+		if (ClientDispatcher::Dispatch(handler, message) == ClientAction::HangUp) {
+			// Out of every room: let the goodbye reach the kernel, then hang up
+			co_await session.Flush();
+			break;
+		}
+	}
+}
+
+ChatServer::ClientAction ChatServer::ClientHandler::On(const TextMessage& message) {
+	if (server.AdmitText(session) && server.AdmitContent(session, message.text, message.name, "deliver your message")) {
+		server.BroadcastMessage(message, session);
+	}
+	return ClientAction::KeepReading;
+}
+
+ChatServer::ClientAction ChatServer::ClientHandler::On(const JoinRoomMessage& message) {
+	if (server.AdmitContent(session, message.rooms, message.name, "join")) {
+		server.JoinRooms(session, message.rooms);
+	}
+	return ClientAction::KeepReading;
+}
+
+ChatServer::ClientAction ChatServer::ClientHandler::On(const LeaveRoomMessage& message) {
+	server.LeaveRoom(session, message.room);
+	return session.m_Rooms.empty() ? ClientAction::HangUp : ClientAction::KeepReading;
+}
+
+ChatServer::ClientAction ChatServer::ClientHandler::On(const DirectMessage& message) {
+	if (!server.AdmitText(session) || !server.AdmitContent(session, message.text, message.peer, "deliver your message")) {
+		return ClientAction::KeepReading;
+	}
+
+	// On the way out 'peer' names the sender
+	std::vector<uint8_t> frame = MessageCodec::Encode(DirectMessage{ message.text, session.m_Name });
+	DirectResult result = server.RouteDirect(frame, message.peer, server.m_Config.nodeId);
+	if (result != DirectResult::Ok) {
+		server.m_Counters.directDropped++;
+		session.Enqueue(MessageCodec::Encode(NotificationMessage{ server.DirectFailureNotice(result, message.peer), "Server" }));
+	}
+	return ClientAction::KeepReading;
+}
+
+bool ChatServer::CheckHello(const ChatMessage& message, int& node) const {
+	if (message.header.messageType != NODE_HELLO) {
+		return false;
+	}
+
+	NodeHelloMessage hello = MessageCodec::Decode<NodeHelloMessage>(message);
+	node = atoi(std::string(hello.nodeId).c_str());
+	return hello.key == m_Config.clusterKey
+		&& node >= 0 && node < static_cast<int>(m_Config.nodes.size()) && node != m_Config.nodeId;
+}
+
+DetachedTask ChatServer::HandlePeer(SOCKET socket, sockaddr_in address) {
+	Session session(m_Reactor, socket, PEER_TURN_QUANTUM);
+
+	// Another server in the cluster dialed us. Only a node above this one dials in, and only
+	// from the address it has in --nodes.
+	ChatMessage message;
+	if (!co_await session.ReadFrame(message)) {
+		co_return;
+	}
+
+	int node = -1;
+	if (!CheckHello(message, node) || node < m_Config.nodeId
+		|| address.sin_family != AF_INET || address.sin_addr.s_addr != m_NodeAddresses[node].sin_addr.s_addr) {
+		printf("Rejected cluster link on Socket %d claiming node %d\n", (int)socket, node);
+		co_return;
+	}
+
+	std::string nodeId = std::to_string(m_Config.nodeId);
+	session.Enqueue(MessageCodec::Encode(NodeHelloMessage{ nodeId, m_Config.clusterKey }));
+
+	PeerHandler handler{ *this, node };
+	PeerUp(node, session);
+	ScopeExit down([&] { PeerDown(node, session); });
+
+	while (co_await session.ReadFrame(message)) {
+		PeerDispatcher::Dispatch(handler, message);
+	}
+}
+
+DetachedTask ChatServer::DialPeer(int node) {
+	sockaddr_in address = m_NodeAddresses[node];
+	while (true) {
+		SOCKET socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (socket != INVALID_SOCKET) {
+			u_long nonBlocking = 1;
+			ioctlsocket(socket, FIONBIO, &nonBlocking);
+
+			BOOL noDelay = TRUE;
+			setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+
+			int result = connect(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+			if (result == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
+				closesocket(socket);
+			}
+			else {
+				// The hello is queued right away and goes out once the connect completes
+				Session link(m_Reactor, socket, PEER_TURN_QUANTUM);
+				std::string nodeId = std::to_string(m_Config.nodeId);
+				link.Enqueue(MessageCodec::Encode(NodeHelloMessage{ nodeId, m_Config.clusterKey }));
+
+				ChatMessage message;
+				int helloNode = -1;
+				if (co_await link.ReadFrame(message) && CheckHello(message, helloNode) && helloNode == node) {
+					PeerHandler handler{ *this, node };
+					PeerUp(node, link);
+					ScopeExit down([&] { PeerDown(node, link); });
+
+					while (co_await link.ReadFrame(message)) {
+						PeerDispatcher::Dispatch(handler, message);
+					}
+				}
+			}
+		}
+
+		co_await m_Reactor.Sleep(PEER_RECONNECT_DELAY);
+	}
+}
+
+void ChatServer::PeerUp(int node, Session& link) {
+	if (m_Peers[node] != nullptr && m_Peers[node] != &link) {
+		m_Peers[node]->Fail();
+	}
+
+	m_Peers[node] = &link;
+	printf("Cluster link to node %d is up\n", node);
+
+	// The owner forgot about us when the link went down; tell it again where we have members
+	std::string nodeId = std::to_string(m_Config.nodeId);
+	for (auto& roomPair : m_Rooms) {
+		ChatRoom& room = roomPair.second;
+		if (room.owner == node && !room.clients.empty()) {
+			link.Enqueue(MessageCodec::Encode(NodeRoomJoinMessage{ room.roomName, nodeId }));
+		}
+	}
+
+	// Likewise for the users whose names it owns
+	for (auto& user : m_Users) {
+		if (NameOwner(user.first) == node) {
+			link.Enqueue(MessageCodec::Encode(NodeUserUpMessage{ user.first, nodeId }));
+		}
+	}
+}
+
+void ChatServer::PeerDown(int node, Session& link) {
+	if (m_Peers[node] != &link) {
+		return;		// Already replaced by a newer link
+	}
+
+	m_Peers[node] = nullptr;
+	printf("Cluster link to node %d is down\n", node);
+
+	for (auto& roomPair : m_Rooms) {
+		removeNode(roomPair.second.nodes, node);
+	}
+
+	// Users there count as offline until the node says otherwise; the next oldest
+	// connection under each of their names, if any, holds it now
+	for (auto it = m_UserNodes.begin(); it != m_UserNodes.end();) {
+		eraseOrdered(it->second, node);
+		it = it->second.empty() ? m_UserNodes.erase(it) : std::next(it);
+	}
+}
+
+void ChatServer::PeerHandler::On(const NodeRoomJoinMessage& message) {
+	ChatRoom& room = server.GetRoom(message.room);
+	if (room.owner == server.m_Config.nodeId && std::find(room.nodes.begin(), room.nodes.end(), node) == room.nodes.end()) {
+		room.nodes.push_back(node);
+	}
+}
+
+void ChatServer::PeerHandler::On(const NodeRoomLeaveMessage& message) {
+	auto it = server.m_Rooms.find(message.room);
+	if (it != server.m_Rooms.end()) {
+		removeNode(it->second.nodes, node);
+	}
+}
+
+void ChatServer::PeerHandler::On(const NodeRouteMessage& message) {
+	server.ForwardFromPeer(node, message.frame, message.header, true);
+}
+
+void ChatServer::PeerHandler::On(const NodeDeliverMessage& message) {
+	server.ForwardFromPeer(node, message.frame, message.header, false);
+}
+
+void ChatServer::PeerHandler::On(const NodeUserUpMessage& message) {
+	if (server.NameOwner(message.name) != server.m_Config.nodeId) {
+		return;
+	}
+
+	server.AddUserNode(std::string(message.name), node);
+}
+
+void ChatServer::PeerHandler::On(const NodeUserDownMessage& message) {
+	server.RemoveUserNode(message.name, node);
+}
+
+void ChatServer::PeerHandler::On(const NodeDirectMessage& message) {
+	std::vector<uint8_t> bytes(message.frame.begin(), message.frame.end());
+	if (server.RouteDirect(bytes, message.target, node) != DirectResult::Ok) {
+		server.m_Counters.directDropped++;
+	}
+}
+
+void ChatServer::ForwardFromPeer(int node, std::string_view frame, std::string_view header, bool route) {
+	// 'header' is "<origin node>:<broadcast id>:<room>,<room>,..."
+	size_t colon = header.find(':');
+	size_t idColon = colon == std::string_view::npos ? colon : header.find(':', colon + 1);
+	if (idColon == std::string_view::npos) {
+		return;
+	}
+
+	int originNode = atoi(std::string(header.substr(0, colon)).c_str());
+	uint64_t broadcastId = strtoull(std::string(header.substr(colon + 1, idColon - colon - 1)).c_str(), nullptr, 10);
+
+	std::vector<ChatRoom*> rooms;
+	bool ownsAll = true;
+	std::istringstream ss(std::string(header.substr(idColon + 1)));
+	std::string roomName;
+	while (std::getline(ss, roomName, ',')) {
+		auto it = m_Rooms.find(roomName);
+		if (it != m_Rooms.end()) {
+			rooms.push_back(&it->second);
+			ownsAll = ownsAll && it->second.owner == node;
+		}
+	}
+
+	// A ROUTE comes straight from the origin; a DELIVER from the origin or from the owner of
+	// every room in it. Anything else was not sent the way RouteToCluster() sends.
+	if (originNode == m_Config.nodeId || (originNode != node && (route || !ownsAll))) {
+		printf("Dropped cluster frame from node %d claiming origin %d\n", node, originNode);
+		return;
+	}
+
+	std::vector<uint8_t> bytes(frame.begin(), frame.end());
+	if (broadcastId == 0) {
+		DeliverLocal(bytes, rooms, nullptr);
+	}
+	else {
+		// Another owner may have sent, or may yet send, this broadcast for other rooms
+		Reactor::Clock::time_point now = m_Reactor.Now();
+		while (!m_SplitBroadcastAges.empty() && now - m_SplitBroadcastAges.front().first > SPLIT_BROADCAST_WINDOW) {
+			m_SplitBroadcasts.erase(m_SplitBroadcastAges.front().second);
+			m_SplitBroadcastAges.pop_front();
+		}
+
+		BroadcastKey key(originNode, broadcastId);
+		auto seen = m_SplitBroadcasts.find(key);
+		if (seen == m_SplitBroadcasts.end()) {
+			DeliverLocal(bytes, rooms, nullptr);
+			m_SplitBroadcasts.emplace(key, rooms);
+			m_SplitBroadcastAges.emplace_back(now, key);
+		}
+		else {
+			DeliverLocal(bytes, rooms, nullptr, &seen->second);
+			seen->second.insert(seen->second.end(), rooms.begin(), rooms.end());
+		}
+	}
+
+	// Only the origin's frames are fanned out again, so nothing travels more than two hops
+	if (route) {
+		RouteToCluster(bytes, rooms, originNode, broadcastId);
+	}
+}
+
+void ChatServer::UpdateMembership(ChatRoom& room) {
+	if (!IsClustered() || room.owner == m_Config.nodeId) {
+		return;
+	}
+
+	// If the link is down this is sent again from PeerUp()
+	Session* link = m_Peers[room.owner];
+	if (link != nullptr) {
+		std::string nodeId = std::to_string(m_Config.nodeId);
+		if (room.clients.empty()) {
+			link->Enqueue(MessageCodec::Encode(NodeRoomLeaveMessage{ room.roomName, nodeId }));
+		}
+		else {
+			link->Enqueue(MessageCodec::Encode(NodeRoomJoinMessage{ room.roomName, nodeId }));
+		}
+	}
+}
+
+ChatRoom& ChatServer::GetRoom(std::string_view roomName) {
+	auto it = m_Rooms.find(roomName);
+	if (it != m_Rooms.end()) {
+		return it->second;
+	}
+
+	// Room doesn't exist, create a new room
+	ChatRoom& room = m_Rooms[std::string(roomName)];
+	room.roomName = roomName;
+	room.limit.Configure(m_Config.roomRate, m_Config.roomBurst, m_Reactor.Now());
+	room.owner = IsClustered() ? m_Ring.Owner(room.roomName) : m_Config.nodeId;
+	return room;
+}
+
+void ChatServer::JoinRooms(Session& session, std::string_view roomList) {
+	// Split the room list into individual room names based on commas
+	std::istringstream ss{ std::string(roomList) };
+	std::string roomName;
+	size_t refused = 0;
+
+	while (std::getline(ss, roomName, ',')) {
+		auto existing = m_Rooms.find(roomName);
+		if (existing != m_Rooms.end()
+			&& std::find(session.m_Rooms.begin(), session.m_Rooms.end(), &existing->second) != session.m_Rooms.end()) {
+			continue;
+		}
+
+		if (m_Config.maxRooms > 0 && session.m_Rooms.size() >= m_Config.maxRooms) {
+			refused++;
+			continue;
+		}
+
+		ChatRoom& room = GetRoom(roomName);
+
+		room.clients.push_back(&session);
+		session.m_Rooms.push_back(&room);
+
+		if (room.clients.size() == 1) {
+			UpdateMembership(room);
+		}
+
+		RecordPresence(room, session.m_Name, true);
+	}
+
+	// One notice per JOIN frame, however many of its rooms were refused
+	if (refused > 0) {
+		m_Counters.rejected++;
+		std::string notice = "Could not join " + std::to_string(refused) + " room(s): a client may be in at most "
+			+ std::to_string(m_Config.maxRooms) + " rooms.";
+		session.Enqueue(MessageCodec::Encode(NotificationMessage{ notice, "Server" }));
+	}
+}
+
+void ChatServer::LeaveRoom(Session& session, std::string_view roomName) {
+	auto it = m_Rooms.find(roomName);
+	if (it == m_Rooms.end()) {
+		return;
+	}
+
+	ChatRoom* room = &it->second;
+	if (!removeClient(room->clients, &session)) {
+		return;
+	}
+
+	if (room->clients.empty()) {
+		UpdateMembership(*room);
+	}
+
+	auto own = std::find(session.m_Rooms.begin(), session.m_Rooms.end(), room);
+	if (own != session.m_Rooms.end()) {
+		session.m_Rooms.erase(own);
+	}
+
+	RecordPresence(*room, session.m_Name, false);
+}
+
+void ChatServer::LeaveAllRooms(Session& session) {
+	// A dropped connection leaves its rooms just like an explicit LEAVE_ROOM
+	for (ChatRoom* room : session.m_Rooms) {
+		if (removeClient(room->clients, &session) && room->clients.empty()) {
+			UpdateMembership(*room);
+		}
+		RecordPresence(*room, session.m_Name, false);
+	}
+	session.m_Rooms.clear();
+}
+
+void ChatServer::RecordPresence(ChatRoom& room, const std::string& name, bool joined) {
+	if (room.presence.empty()) {
+		m_PresenceRooms.push_back(&room);
+	}
+
+	// Joined and left again (or the other way round) within one window: nothing to announce
+	auto it = room.presence.find(name);
+	if (it != room.presence.end() && it->second != joined) {
+		room.presence.erase(it);
+	}
+	else {
+		room.presence[name] = joined;
+	}
+
+	if (m_Config.presenceWindow.count() == 0) {
+		FlushPresence();
+	}
+}
+
+void ChatServer::FlushPresence() {
+	for (ChatRoom* room : m_PresenceRooms) {
+		SendPresence(*room);
+	}
+	m_PresenceRooms.clear();
+}
+
+void ChatServer::SendPresence(ChatRoom& room) {
+	if (room.presence.empty()) {
+		return;		// Everything cancelled out
+	}
+
+	size_t joined = 0;
+	std::string changes;
+	std::vector<ChatRoom*> rooms(1, &room);
+
+	auto publish = [&] {
+		std::vector<uint8_t> frame = MessageCodec::Encode(PresenceMessage{ room.roomName, changes });
+		DeliverLocal(frame, rooms, nullptr);
+		if (IsClustered()) {
+			RouteToCluster(frame, rooms, m_Config.nodeId, 0);
+		}
+		changes.clear();
+	};
+
+	for (auto& change : room.presence) {
+		// Start a new frame rather than let this line take the current one over the limit
+		size_t line = change.first.size() + 2;
+		if (!changes.empty() && MessageCodec::FrameSize(room.roomName, changes) + line > PRESENCE_FRAME_BYTES) {
+			publish();
+		}
+
+		changes.push_back(change.second ? '+' : '-');
+		changes += change.first;
+		changes.push_back('\n');
+		joined += change.second ? 1 : 0;
+	}
+
+	if (!changes.empty()) {
+		publish();
+	}
+
+	printf("%s: %zu joined, %zu left\n", room.roomName.c_str(), joined, room.presence.size() - joined);
+	room.presence.clear();
+}
+
+void ChatServer::RegisterUser(Session& session) {
+	std::vector<Session*>& sessions = m_Users[session.m_Name];
+	sessions.push_back(&session);
+	if (sessions.size() > 1) {
+		session.Enqueue(MessageCodec::Encode(NotificationMessage{ nameInUseNotice(session.m_Name), "Server" }));
+		return;		// This node already has the name
+	}
+
+	if (NameOwner(session.m_Name) != m_Config.nodeId) {
+		SendUserState(session.m_Name, true);
+	}
+	else {
+		AddUserNode(session.m_Name, m_Config.nodeId);
+	}
+}
+
+void ChatServer::UnregisterUser(Session& session) {
+	auto it = m_Users.find(session.m_Name);
+	if (it == m_Users.end() || !eraseOrdered(it->second, &session)) {
+		return;		// Never registered
+	}
+
+	if (!it->second.empty()) {
+		return;		// The next oldest connection here has the name now
+	}
+
+	m_Users.erase(it);
+	if (NameOwner(session.m_Name) != m_Config.nodeId) {
+		SendUserState(session.m_Name, false);
+	}
+	else {
+		RemoveUserNode(session.m_Name, m_Config.nodeId);
+	}
+}
+
+void ChatServer::AddUserNode(const std::string& name, int node) {
+	std::vector<int>& nodes = m_UserNodes[name];
+	if (std::find(nodes.begin(), nodes.end(), node) != nodes.end()) {
+		return;
+	}
+
+	nodes.push_back(node);
+	if (nodes.size() > 1) {
+		// Someone else has the name; the notice goes the way a DIRECT would
+		std::vector<uint8_t> notice = MessageCodec::Encode(NotificationMessage{ nameInUseNotice(name), "Server" });
+		if (node != m_Config.nodeId) {
+			SendDirectToNode(node, notice, name);
+		}
+		else {
+			m_Users[name].front()->Enqueue(notice);
+		}
+		return;
+	}
+
+	// Anything that waited for this user follows them to their connection
+	auto mailbox = m_Mailboxes.find(name);
+	if (mailbox != m_Mailboxes.end()) {
+		std::deque<std::vector<uint8_t>> waiting = std::move(mailbox->second.frames);
+		EraseMailbox(mailbox);
+		for (const std::vector<uint8_t>& frame : waiting) {
+			RouteDirect(frame, name, m_Config.nodeId);
+		}
+	}
+}
+
+void ChatServer::RemoveUserNode(std::string_view name, int node) {
+	auto it = m_UserNodes.find(name);
+	if (it != m_UserNodes.end() && eraseOrdered(it->second, node) && it->second.empty()) {
+		m_UserNodes.erase(it);
+	}
+}
+
+int ChatServer::NameOwner(std::string_view name) const {
+	return IsClustered() ? m_Ring.Owner(std::string(name)) : m_Config.nodeId;
+}
+
+ChatServer::DirectResult ChatServer::RouteDirect(const std::vector<uint8_t>& frame, std::string_view target, int fromNode) {
+	int owner = NameOwner(target);
+	if (owner != m_Config.nodeId) {
+		// Only the owner knows which connection holds the name, even when the user is here,
+		// so a DIRECT from a client always goes through it. One the owner sends is for the
+		// connection here.
+		if (fromNode == owner) {
+			auto user = m_Users.find(target);
+			if (user != m_Users.end()) {
+				user->second.front()->Enqueue(frame);
+				return DirectResult::Ok;
+			}
+			// The user has just left; our USER_DOWN is ahead of this on the link, so the owner will keep it for them
+		}
+
+		if (m_Peers[owner] == nullptr) {
+			return DirectResult::OwnerUnreachable;
+		}
+		SendDirectToNode(owner, frame, target);
+		return DirectResult::Ok;
+	}
+
+	auto nodes = m_UserNodes.find(target);
+	if (nodes != m_UserNodes.end()) {
+		int holder = nodes->second.front();
+		if (holder == m_Config.nodeId) {
+			m_Users.find(target)->second.front()->Enqueue(frame);
+			return DirectResult::Ok;
+		}
+		// Nothing comes back from the holder's node for its own user: if they left, its USER_DOWN
+		// arrived first and the next connection, or the mailbox, gets the message
+		if (m_Peers[holder] != nullptr) {
+			SendDirectToNode(holder, frame, target);
+			return DirectResult::Ok;
+		}
+	}
+
+	return StoreDirect(frame, target);
+}
+
+ChatServer::DirectResult ChatServer::StoreDirect(const std::vector<uint8_t>& frame, std::string_view target) {
+	if (m_Config.mailboxSize == 0) {
+		return DirectResult::NotOnline;
+	}
+	if (frame.size() > m_Config.mailboxBytes) {
+		return DirectResult::TooLarge;
+	}
+
+	// Full: the sender is told, rather than silently losing the oldest message
+	auto mailbox = m_Mailboxes.find(target);
+	if (mailbox != m_Mailboxes.end() && mailbox->second.frames.size() >= m_Config.mailboxSize) {
+		return DirectResult::MailboxFull;
+	}
+
+	// Over the node's limits: the longest-waiting mailboxes give way, never the one written to
+	auto overLimits = [&] {
+		return m_MailboxBytes + frame.size() > m_Config.mailboxBytes
+			|| (mailbox == m_Mailboxes.end() && m_Mailboxes.size() >= m_Config.maxMailboxes);
+	};
+
+	auto age = m_MailboxAges.begin();
+	while (overLimits() && age != m_MailboxAges.end()) {
+		auto oldest = m_Mailboxes.find(*age++);
+		if (oldest != mailbox) {
+			m_Counters.directDropped += oldest->second.frames.size();
+			EraseMailbox(oldest);
+		}
+	}
+
+	// Only this mailbox is left, or no mailboxes are allowed at all
+	if (overLimits()) {
+		return mailbox != m_Mailboxes.end() ? DirectResult::MailboxFull : DirectResult::NotOnline;
+	}
+
+	if (mailbox == m_Mailboxes.end()) {
+		mailbox = m_Mailboxes.emplace(std::string(target), Mailbox()).first;
+		mailbox->second.created = Reactor::Clock::now();	// Not Now(): the turn may have started with a long idle poll
+		mailbox->second.age = m_MailboxAges.insert(m_MailboxAges.end(), mailbox->first);
+	}
+
+	mailbox->second.frames.push_back(frame);
+	mailbox->second.bytes += frame.size();
+	m_MailboxBytes += frame.size();
+	return DirectResult::Ok;
+}
+
+std::string ChatServer::DirectFailureNotice(DirectResult result, std::string_view target) {
+	std::string name(target);
+	switch (result) {
+	case DirectResult::MailboxFull: return "Could not deliver your message: " + name + " has too many messages waiting.";
+	case DirectResult::TooLarge: return "Could not deliver your message: " + name + " is not online and it is too large to keep for them.";
+	case DirectResult::OwnerUnreachable: return "Could not deliver your message: the server holding " + name + " is unreachable.";
+	default: return "Could not deliver your message: " + name + " is not online.";
+	}
+}
+
+void ChatServer::ExpireMailboxes() {
+	Reactor::Clock::time_point now = m_Reactor.Now();
+	while (!m_MailboxAges.empty()) {
+		auto oldest = m_Mailboxes.find(m_MailboxAges.front());
+		if (now - oldest->second.created < m_Config.mailboxTtl) {
+			break;
+		}
+
+		m_Counters.directDropped += oldest->second.frames.size();
+		EraseMailbox(oldest);
+	}
+}
+
+void ChatServer::EraseMailbox(NameMap<Mailbox>::iterator mailbox) {
+	m_MailboxBytes -= mailbox->second.bytes;
+	m_MailboxAges.erase(mailbox->second.age);
+	m_Mailboxes.erase(mailbox);
+}
+
+void ChatServer::SendDirectToNode(int node, const std::vector<uint8_t>& frame, std::string_view target) {
+	m_Peers[node]->Enqueue(MessageCodec::Encode(NodeDirectMessage{ frameBytes(frame), target }));
+}
+
+void ChatServer::SendUserState(const std::string& name, bool up) {
+	// If the link is down this is sent again from PeerUp()
+	Session* link = m_Peers[NameOwner(name)];
+	if (link == nullptr) {
+		return;
+	}
+
+	std::string nodeId = std::to_string(m_Config.nodeId);
+	if (up) {
+		link->Enqueue(MessageCodec::Encode(NodeUserUpMessage{ name, nodeId }));
+	}
+	else {
+		link->Enqueue(MessageCodec::Encode(NodeUserDownMessage{ name, nodeId }));
+	}
+}
+
+bool ChatServer::AdmitText(Session& session) {
+	if (session.m_TextLimit.TryConsume(m_Reactor.Now())) {
+		session.m_Throttled = false;
+		return true;
+	}
+
+	m_Counters.sessionThrottled++;
+
+	// Tell the sender once per episode rather than once per dropped message
+	if (!session.m_Throttled) {
+		session.m_Throttled = true;
+		session.Enqueue(MessageCodec::Encode(NotificationMessage{ "You are sending messages too fast; some were not delivered.", "Server" }));
+	}
+	return false;
+}
+
+bool ChatServer::AdmitContent(Session& session, std::string_view text, std::string_view name, const char* action) {
+	ContentFilter::Verdict verdict = m_Filter.Check(text, name);
+	if (verdict == ContentFilter::Verdict::Ok) {
+		return true;
+	}
+
+	m_Counters.rejected++;
+
+	// Only frames that got past the rate limit get here, so one notice each is bounded too
+	std::string notice = std::string("Could not ") + action + ": " + ContentFilter::VerdictText(verdict) + ".";
+	session.Enqueue(MessageCodec::Encode(NotificationMessage{ notice, "Server" }));
+	return false;
+}
+
+void ChatServer::ReportCounters() {
+	if (m_Counters.sessionThrottled == m_ReportedCounters.sessionThrottled
+		&& m_Counters.roomThrottled == m_ReportedCounters.roomThrottled
+		&& m_Counters.rejected == m_ReportedCounters.rejected
+		&& m_Counters.directDropped == m_ReportedCounters.directDropped) {
+		return;
+	}
+
+	printf("Throttled messages: %llu by client limit, %llu by room limit; %llu rejected by content rules; %llu direct messages dropped\n",
+		(unsigned long long)m_Counters.sessionThrottled, (unsigned long long)m_Counters.roomThrottled,
+		(unsigned long long)m_Counters.rejected, (unsigned long long)m_Counters.directDropped);
+	m_ReportedCounters = m_Counters;
+}
+
+void ChatServer::BroadcastFrame(const std::vector<uint8_t>& frame, MESSAGE_TYPE type, Session& sender) {
+	// Encoded once; every recipient, local or on another node, gets a copy of the same bytes
+	m_TargetRooms.clear();
+	for (ChatRoom* room : sender.m_Rooms) {
+		// Join/leave notices always go out; only chat traffic counts against the room
+		if (type == TEXT && !room->limit.TryConsume(m_Reactor.Now())) {
+			m_Counters.roomThrottled++;
+			continue;
+		}
+
+		m_TargetRooms.push_back(room);
+	}
+
+	DeliverLocal(frame, m_TargetRooms, &sender);
+
+	if (IsClustered()) {
+		RouteToCluster(frame, m_TargetRooms, m_Config.nodeId, 0);
+	}
+}
+
+void ChatServer::DeliverLocal(const std::vector<uint8_t>& frame, const std::vector<ChatRoom*>& rooms, Session* exclude,
+	const std::vector<ChatRoom*>* delivered) {
+	// Stamping recipients with this broadcast's epoch replaces the per-call std::set:
+	// a client sharing several rooms with the sender is skipped after its first copy.
+	uint64_t epoch = ++m_BroadcastEpoch;
+	if (exclude != nullptr) {
+		exclude->m_BroadcastEpoch = epoch;
+	}
+
+	if (delivered != nullptr) {
+		for (ChatRoom* room : *delivered) {
+			for (Session* client : room->clients) {
+				client->m_BroadcastEpoch = epoch;
+			}
+		}
+	}
+
+	for (ChatRoom* room : rooms) {
+		for (Session* client : room->clients) {
+			if (client->m_BroadcastEpoch == epoch) {
+				continue;
+			}
+
+			client->m_BroadcastEpoch = epoch;
+			client->Enqueue(frame);
+		}
+	}
+}
+
+void ChatServer::RouteToCluster(const std::vector<uint8_t>& frame, const std::vector<ChatRoom*>& rooms, int originNode, uint64_t broadcastId) {
+	bool isOrigin = originNode == m_Config.nodeId;
+
+	// Room lists go in the header of a frame that also carries 'frame', so a long list is
+	// split over several frames, each within MessageCodec::MAX_PACKET_SIZE
+	size_t frameSize = MessageCodec::FrameSize(frameBytes(frame), "") + MAX_ROUTE_PREFIX;
+	size_t headerBudget = frameSize < MessageCodec::MAX_PACKET_SIZE ? MessageCodec::MAX_PACKET_SIZE - frameSize : 0;
+
+	// With a single owner and a list that fits one frame every node gets one frame at most.
+	// Otherwise a node can hear about the broadcast several times, from several owners or
+	// in several parts, and needs the id to deliver it to each member once.
+	if (isOrigin && broadcastId == 0) {
+		size_t listLength = 0;
+		for (ChatRoom* room : rooms) {
+			listLength += room->roomName.size() + 1;
+			if (room->owner != rooms.front()->owner || listLength > headerBudget) {
+				broadcastId = ++m_ClusterBroadcastId;
+				break;
+			}
+		}
+	}
+
+	for (std::vector<ChatRoom*>& nodeRooms : m_NodeRooms) {
+		nodeRooms.clear();
+	}
+
+	for (ChatRoom* room : rooms) {
+		if (room->owner == m_Config.nodeId) {
+			for (int node : room->nodes) {
+				if (node != originNode) {
+					m_NodeRooms[node].push_back(room);
+				}
+			}
+		}
+		else if (isOrigin) {
+			m_NodeRooms[room->owner].push_back(room);
+		}
+	}
+
+	for (size_t node = 0; node < m_NodeRooms.size(); node++) {
+		const std::vector<ChatRoom*>& nodeRooms = m_NodeRooms[node];
+
+		// Rooms are only tracked while the link is up, so a missing link means nobody to reach
+		if (nodeRooms.empty() || m_Peers[node] == nullptr) {
+			continue;
+		}
+
+		// One frame per node for the whole broadcast, unless its rooms don't fit in one. A node
+		// that owns one of a frame's rooms gets it as a ROUTE and passes it on to that room's
+		// other nodes.
+		std::string prefix = std::to_string(originNode) + ":" + std::to_string(broadcastId) + ":";
+		std::string header = prefix;
+		bool route = false;
+
+		auto send = [&] {
+			if (route) {
+				m_Peers[node]->Enqueue(MessageCodec::Encode(NodeRouteMessage{ frameBytes(frame), header }));
+			}
+			else {
+				m_Peers[node]->Enqueue(MessageCodec::Encode(NodeDeliverMessage{ frameBytes(frame), header }));
+			}
+			header = prefix;
+			route = false;
+		};
+
+		for (ChatRoom* room : nodeRooms) {
+			// Names are bounded by --max-text, which leaves room for at least one per frame
+			if (room->roomName.size() > headerBudget) {
+				continue;
+			}
+
+			bool first = header.size() == prefix.size();
+			if (!first && header.size() - prefix.size() + 1 + room->roomName.size() > headerBudget) {
+				send();
+				first = true;
+			}
+
+			if (!first) {
+				header.push_back(',');
+			}
+			header += room->roomName;
+			route = route || (isOrigin && room->owner == static_cast<int>(node));
+		}
+
+		if (header.size() > prefix.size()) {
+			send();
+		}
+	}
+}
+
+Listener::Listener(ChatServer& server, Reactor& reactor, SOCKET listenSocket, Endpoint endpoint)
+	: m_Server(server)
+	, m_Reactor(reactor)
+	, m_ListenSocket(listenSocket)
+	, m_Endpoint(endpoint) {
+	u_long nonBlocking = 1;
+	ioctlsocket(m_ListenSocket, FIONBIO, &nonBlocking);
+
+	m_Reactor.Register(this);
+}
+
+Listener::~Listener() {
+	m_Reactor.Unregister(this);
+}
+
+void Listener::OnPollEvents(short revents) {
+	m_Server.AcceptConnections(m_ListenSocket, m_Endpoint);
+}
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include "Reactor.h"
+#include "Session.h"
+#include "Task.h"
+#include "TokenBucket.h"
+#include "HashRing.h"
+#include "ContentFilter.h"
+#include "Message.h"
+#include "MessageCodec.h"
+
+// Define a data structure to represent a room
+struct ChatRoom {
+	std::string roomName;			// Room name to represent a room
+	std::vector<Session*> clients;	// List of clients in this room
+	TokenBucket limit;				// TEXT messages broadcast into this room
+	int owner = 0;					// Cluster node that tracks which nodes have members
+	std::vector<int> nodes;			// On the owner: other nodes with members in this room
+
+	// Presence changes not announced yet: member name -> joined (true) or left (false)
+	std::unordered_map<std::string, bool> presence;
+};
+
+// Flow control settings. A rate of 0 disables that limit.
+struct ServerConfig {
+	double sessionRate = 20.0;		// TEXT messages per second per client
+	double sessionBurst = 40.0;
+	double roomRate = 1000.0;		// TEXT messages per second into one room
+	double roomBurst = 2000.0;
+	size_t turnQuantum = 16 * 1024;	// Bytes of input each client may process per reactor turn
+
+	// Join/leave notices for a room are collected for this long and sent as one PRESENCE
+	// frame. 0 sends every change on its own, as soon as it happens.
+	std::chrono::milliseconds presenceWindow = std::chrono::milliseconds(250);
+
+	// Content rules for TEXT bodies, names and joined room lists, in bytes. 0 = the most
+	// the server can carry between nodes (30 KB of text, 1 KB names), which also caps larger values.
+	size_t maxTextBytes = 2000;
+	size_t maxNameBytes = 32;
+	std::vector<std::string> bannedTerms;	// Case-insensitive substrings
+
+	// Rooms one client may be in at once; joins past it are refused. 0 = no limit.
+	size_t maxRooms = 100;
+
+	// DIRECT messages kept per offline user until they connect. 0 = offline users get none.
+	size_t mailboxSize = 100;
+
+	// Limits on all mailboxes of a node together. Past either one the oldest mailboxes are
+	// dropped to make room, and any mailbox is dropped once it has waited 'mailboxTtl'
+	// unclaimed (0 = kept until claimed or pushed out).
+	size_t maxMailboxes = 10000;
+	size_t mailboxBytes = 64 * 1024 * 1024;
+	std::chrono::seconds mailboxTtl = std::chrono::hours(24);
+
+	std::string port;				// Client listen port
+
+	// Same-machine clients: an AF_UNIX socket path (empty = none), and whether its
+	// clients may move their traffic onto a shared-memory ring of 'ringSize' bytes.
+	std::string localPath;
+	bool sharedMemory = false;
+	uint32_t ringSize = 1024 * 1024;
+
+	// Cluster membership: every node's "host:port" for links between nodes, identical on
+	// all nodes. Empty = standalone. Clients never use these; they connect to 'port'.
+	std::vector<std::string> nodes;
+	int nodeId = 0;					// This server's index in 'nodes'
+	std::string clusterKey;			// Shared by every node and checked in NODE_HELLO; empty = none
+};
+
+// Messages dropped by the limits above
+struct ThrottleCounters {
+	uint64_t sessionThrottled = 0;
+	uint64_t roomThrottled = 0;
+	uint64_t rejected = 0;			// Failed the content rules
+	uint64_t directDropped = 0;		// DIRECT messages with a full mailbox or no route, or left unclaimed
+};
+
+class ChatServer;
+
+// Where a connection came in, which decides what it may do: clients over TCP, clients on
+// this machine over AF_UNIX (who may ask for shared memory), or other cluster nodes
+enum class Endpoint { Tcp, Local, Cluster };
+
+// A listen socket besides the main TCP one; its connections are handed to the ChatServer
+class Listener : public PollHandler {
+public:
+	Listener(ChatServer& server, Reactor& reactor, SOCKET listenSocket, Endpoint endpoint);
+	~Listener();
+
+	// PollHandler
+	SOCKET Socket() const override { return m_ListenSocket; }
+	short PollEvents() const override { return POLLRDNORM; }
+	void OnPollEvents(short revents) override;
+
+private:
+	ChatServer& m_Server;
+	Reactor& m_Reactor;
+	SOCKET m_ListenSocket;
+	Endpoint m_Endpoint;
+};
+
+// Accepts connections on the listen socket and runs one handler coroutine per client.
+// Everything runs on the reactor thread, so rooms and sessions need no locking.
+class ChatServer : public PollHandler {
+public:
+	ChatServer(Reactor& reactor, SOCKET listenSocket, const ServerConfig& config);
+	~ChatServer();
+
+	// Also accept same-machine clients on an AF_UNIX listen socket
+	void ListenLocal(SOCKET localSocket);
+
+	// Accept links from the other cluster nodes on their own listen socket, never the client one
+	void ListenCluster(SOCKET clusterSocket);
+
+	// Create pre-defined rooms for users to enter
+	void CreateRooms();
+
+	// Start linking up with the other cluster nodes. Returns false if a node address is invalid.
+	// Call it before ListenCluster(): links are only accepted from the resolved node addresses.
+	bool StartCluster();
+
+	const ThrottleCounters& Counters() const { return m_Counters; }
+
+	// PollHandler
+	SOCKET Socket() const override { return m_ListenSocket; }
+	short PollEvents() const override { return POLLRDNORM; }
+	void OnPollEvents(short revents) override;
+
+private:
+	friend class Listener;
+
+	// What a client connection does once one of its frames has been handled
+	enum class ClientAction { KeepReading, HangUp };
+
+	// Frames from a client, dispatched by message type
+	struct ClientHandler {
+		ChatServer& server;
+		Session& session;
+
+		ClientAction On(const TextMessage& message);
+		ClientAction On(const JoinRoomMessage& message);
+		ClientAction On(const LeaveRoomMessage& message);
+		ClientAction On(const DirectMessage& message);
+	};
+
+	// Frames from another cluster node
+	struct PeerHandler {
+		ChatServer& server;
+		int node;
+
+		void On(const NodeRoomJoinMessage& message);
+		void On(const NodeRoomLeaveMessage& message);
+		void On(const NodeRouteMessage& message);
+		void On(const NodeDeliverMessage& message);
+		void On(const NodeUserUpMessage& message);
+		void On(const NodeUserDownMessage& message);
+		void On(const NodeDirectMessage& message);
+	};
+
+	// NOTIFICATION only goes from the server to clients; one from a client is ignored like
+	// any other type not listed here, so it never reaches the log or anyone else
+	typedef MessageDispatcher<ClientHandler, ClientAction,
+		TextMessage, JoinRoomMessage, LeaveRoomMessage, DirectMessage> ClientDispatcher;
+	typedef MessageDispatcher<PeerHandler, void,
+		NodeRoomJoinMessage, NodeRoomLeaveMessage, NodeRouteMessage, NodeDeliverMessage,
+		NodeUserUpMessage, NodeUserDownMessage, NodeDirectMessage> PeerDispatcher;
+
+	// Hashes anything that converts to std::string_view, so frame fields can look up names without a copy
+	struct NameHash {
+		typedef void is_transparent;
+		size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); }
+	};
+
+	template <typename T>
+	using NameMap = std::unordered_map<std::string, T, NameHash, std::equal_to<>>;
+
+	void AcceptConnections(SOCKET listenSocket, Endpoint endpoint);
+	DetachedTask HandleClient(SOCKET socket, bool local);
+	DetachedTask HandlePeer(SOCKET socket, sockaddr_in address);
+	DetachedTask DialPeer(int node);
+
+	// Check the NODE_HELLO a link opened with: the key matches and 'node' is a valid peer id
+	bool CheckHello(const ChatMessage& message, int& node) const;
+
+	ChatRoom& GetRoom(std::string_view roomName);
+	void JoinRooms(Session& session, std::string_view roomList);
+	void LeaveRoom(Session& session, std::string_view roomName);
+	void LeaveAllRooms(Session& session);
+
+	// Queue a presence change for the room's next PRESENCE frame
+	void RecordPresence(ChatRoom& room, const std::string& name, bool joined);
+	void FlushPresence();
+	void SendPresence(ChatRoom& room);
+
+	// Index the session under its user name. The oldest connection under a name holds it and
+	// gets its DIRECT messages and mailbox; a newer one is told the name is in use, and takes
+	// it over once the older ones have left.
+	void RegisterUser(Session& session);
+	void UnregisterUser(Session& session);
+
+	// The cluster node that knows where a user is connected and keeps their mailbox
+	int NameOwner(std::string_view name) const;
+
+	// On the name's owner: 'node' has its first connection under 'name', or its last one left
+	void AddUserNode(const std::string& name, int node);
+	void RemoveUserNode(std::string_view name, int node);
+
+	// Why a DIRECT message was dropped, if it was
+	enum class DirectResult { Ok, NotOnline, MailboxFull, TooLarge, OwnerUnreachable };
+
+	// Deliver a DIRECT frame to 'target': through the name's owner to the connection that
+	// holds the name, or into the owner's mailbox. 'fromNode' is where it came from.
+	DirectResult RouteDirect(const std::vector<uint8_t>& frame, std::string_view target, int fromNode);
+	DirectResult StoreDirect(const std::vector<uint8_t>& frame, std::string_view target);
+	static std::string DirectFailureNotice(DirectResult result, std::string_view target);
+	void ExpireMailboxes();
+	void SendDirectToNode(int node, const std::vector<uint8_t>& frame, std::string_view target);
+	void SendUserState(const std::string& name, bool up);
+
+	// Apply the sender's rate limit; false if the message must be dropped
+	bool AdmitText(Session& session);
+
+	// Apply the content rules; false (and the sender is told why) if the frame must be dropped
+	bool AdmitContent(Session& session, std::string_view text, std::string_view name, const char* action);
+	void ReportCounters();
+
+	// Send to every other member of the sender's rooms, once per client, on every node
+	template <typename T>
+	void BroadcastMessage(const T& message, Session& sender) {
+		BroadcastFrame(MessageCodec::Encode(message), T::TYPE, sender);
+	}
+	void BroadcastFrame(const std::vector<uint8_t>& frame, MESSAGE_TYPE type, Session& sender);
+
+	// Enqueue 'frame' to local members of 'rooms', skipping 'exclude' and anyone in a room
+	// of 'delivered', whose members already got this broadcast
+	void DeliverLocal(const std::vector<uint8_t>& frame, const std::vector<ChatRoom*>& rooms, Session* exclude,
+		const std::vector<ChatRoom*>* delivered = nullptr);
+
+	// Cluster side of a broadcast: rooms this node owns are fanned out to their member
+	// nodes, the rest go to their owners. A node gets one frame from each owner involved,
+	// so when the rooms have several owners the origin gives the broadcast a non-zero
+	// 'broadcastId' (0 = pick one) for receivers to drop the second copy by.
+	void RouteToCluster(const std::vector<uint8_t>& frame, const std::vector<ChatRoom*>& rooms, int originNode, uint64_t broadcastId);
+
+	// Tell the room's owner whether this node has members in it
+	void UpdateMembership(ChatRoom& room);
+	void PeerUp(int node, Session& link);
+	void PeerDown(int node, Session& link);
+
+	// A client frame relayed by 'node', dropped unless 'node' is its origin or owns its rooms;
+	// with 'route' it is also passed on to the rooms' other nodes
+	void ForwardFromPeer(int node, std::string_view frame, std::string_view header, bool route);
+
+	bool IsClustered() const { return m_Config.nodes.size() > 1; }
+
+	Reactor& m_Reactor;
+	SOCKET m_ListenSocket;
+	ServerConfig m_Config;
+	std::unique_ptr<Listener> m_LocalListener;
+	std::unique_ptr<Listener> m_ClusterListener;
+	uint32_t m_ChannelCounter;						// Makes shared-memory names unique
+
+	ContentFilter m_Filter;
+	ThrottleCounters m_Counters;
+	ThrottleCounters m_ReportedCounters;
+
+	std::map<std::string, ChatRoom, std::less<>> m_Rooms;	// std::less<>: frame fields look rooms up without a copy
+
+	NameMap<std::vector<Session*>> m_Users;			// Connections on this node by user name, oldest first
+	NameMap<std::vector<int>> m_UserNodes;			// For names this node owns: nodes with a connection under it, oldest first
+
+	// For names this node owns: DIRECT frames for an offline user
+	struct Mailbox {
+		std::deque<std::vector<uint8_t>> frames;
+		size_t bytes = 0;
+		Reactor::Clock::time_point created;
+		std::list<std::string>::iterator age;		// This mailbox's entry in m_MailboxAges
+	};
+
+	// Forget a mailbox and its bytes; the caller has taken or counted its frames
+	void EraseMailbox(NameMap<Mailbox>::iterator mailbox);
+
+	NameMap<Mailbox> m_Mailboxes;
+	std::list<std::string> m_MailboxAges;			// Names with a mailbox, oldest first
+	size_t m_MailboxBytes;							// Frame bytes in all of them
+	uint64_t m_BroadcastEpoch;
+
+	// Broadcasts that can reach this node in several frames, by (origin node, broadcast id):
+	// the rooms already delivered here. Forgotten after a while, oldest first.
+	typedef std::pair<int, uint64_t> BroadcastKey;
+	std::map<BroadcastKey, std::vector<ChatRoom*>> m_SplitBroadcasts;
+	std::deque<std::pair<Reactor::Clock::time_point, BroadcastKey>> m_SplitBroadcastAges;
+	uint64_t m_ClusterBroadcastId;					// Last id this node gave a split broadcast
+
+	HashRing m_Ring;
+	std::vector<sockaddr_in> m_NodeAddresses;		// Every node's resolved cluster address
+	std::vector<Session*> m_Peers;					// Live link per node, null if down or self
+	std::vector<ChatRoom*> m_TargetRooms;			// Scratch for BroadcastFrame
+	std::vector<ChatRoom*> m_PresenceRooms;			// Rooms with presence changes to send
+	std::vector<std::vector<ChatRoom*>> m_NodeRooms;	// Scratch for RouteToCluster, per node
+};
@@ -0,0 +1,600 @@
+#include "ContentFilter.h"
+
+#include <algorithm>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CONTENT_FILTER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC compiles any intrinsic in any function; the caller checks the CPU first
+#define TARGET_SSE42
+#define TARGET_AVX2
+#else
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+	// UTF-8 error classes. A byte pair is bad if its three lookups below share a bit.
+	const uint8_t TOO_SHORT = 1 << 0;		// Lead byte or ASCII where a continuation was due
+	const uint8_t TOO_LONG = 1 << 1;		// Continuation after ASCII
+	const uint8_t OVERLONG_3 = 1 << 2;		// E0 80..9F
+	const uint8_t TOO_LARGE = 1 << 3;		// Above U+10FFFF
+	const uint8_t SURROGATE = 1 << 4;		// ED A0..BF
+	const uint8_t OVERLONG_2 = 1 << 5;		// C0, C1
+	const uint8_t TOO_LARGE_1000 = 1 << 6;	// F5.. or F4 90..
+	const uint8_t OVERLONG_4 = 1 << 6;		// F0 80..8F
+	const uint8_t TWO_CONTS = 1 << 7;		// Continuation after continuation; checked against the length below
+	const uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+	// Indexed by the previous byte's high nibble
+	alignas(16) const uint8_t PREV_HIGH[16] = {
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+		TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+		TOO_SHORT | OVERLONG_2,
+		TOO_SHORT,
+		TOO_SHORT | OVERLONG_3 | SURROGATE,
+		TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+	};
+
+	// Indexed by the previous byte's low nibble
+	alignas(16) const uint8_t PREV_LOW[16] = {
+		CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+		CARRY | OVERLONG_2,
+		CARRY,
+		CARRY,
+		CARRY | TOO_LARGE,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+	};
+
+	// Indexed by the current byte's high nibble
+	alignas(16) const uint8_t CURRENT_HIGH[16] = {
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	};
+
+	// Subtracted (saturating) from a block: non-zero if its last three bytes start a
+	// sequence that runs into the next block
+	alignas(16) const uint8_t INCOMPLETE_LIMIT[16] = {
+		0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+		0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1,
+	};
+
+	// ORed into four bytes at once: folds ASCII letters to lower case (and a few other
+	// bytes together, so it can only produce false candidates, never miss one)
+	const uint32_t FOLD_CASE = 0x20202020;
+
+	uint8_t lowerAscii(uint8_t c) {
+		return (c >= 'A' && c <= 'Z') ? static_cast<uint8_t>(c + ('a' - 'A')) : c;
+	}
+
+	// True if all 'length' bytes are below 0x80, eight at a time
+	bool isAscii(const uint8_t* data, size_t length) {
+		size_t i = 0;
+		for (; i + 8 <= length; i += 8) {
+			uint64_t word;
+			memcpy(&word, data + i, sizeof(word));
+			if (word & 0x8080808080808080ULL) {
+				return false;
+			}
+		}
+		for (; i < length; i++) {
+			if (data[i] & 0x80) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Where the scalar check takes over from a block kernel that covered [0, checked):
+	// at the lead byte of a sequence that may run past the last block, if there is one.
+	size_t resumePoint(const uint8_t* data, size_t checked) {
+		size_t back = 0;
+		while (back < 3 && back < checked && (data[checked - 1 - back] & 0xC0) == 0x80) {
+			back++;
+		}
+		if (back < checked && data[checked - 1 - back] >= 0xC0) {
+			return checked - 1 - back;
+		}
+		return checked;
+	}
+
+#if defined(CONTENT_FILTER_X86)
+	// Error bits for 'input', given the block before it
+	TARGET_SSE42 __m128i utf8Errors(__m128i input, __m128i previous) {
+		const __m128i nibble = _mm_set1_epi8(0x0F);
+
+		__m128i prev1 = _mm_alignr_epi8(input, previous, 16 - 1);
+		__m128i special = _mm_and_si128(
+			_mm_and_si128(
+				_mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(PREV_HIGH)), _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+				_mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(PREV_LOW)), _mm_and_si128(prev1, nibble))),
+			_mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(CURRENT_HIGH)), _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+
+		// Third and fourth bytes of 3- and 4-byte sequences must be continuations: exactly
+		// where TWO_CONTS is expected, and nowhere else
+		__m128i prev2 = _mm_alignr_epi8(input, previous, 16 - 2);
+		__m128i prev3 = _mm_alignr_epi8(input, previous, 16 - 3);
+		__m128i mustContinue = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+			_mm_subs_epu8(prev3, _mm_set1_epi8(static_cast<char>(0xF0 - 0x80))));
+		mustContinue = _mm_and_si128(mustContinue, _mm_set1_epi8(static_cast<char>(0x80)));
+
+		return _mm_xor_si128(mustContinue, special);
+	}
+
+	TARGET_AVX2 __m256i utf8Errors(__m256i input, __m256i previous) {
+		const __m256i nibble = _mm256_set1_epi8(0x0F);
+		const __m256i prevHigh = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(PREV_HIGH)));
+		const __m256i prevLow = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(PREV_LOW)));
+		const __m256i currentHigh = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(CURRENT_HIGH)));
+
+		// alignr works per 128-bit lane, so pair each lane with the one before it
+		__m256i carried = _mm256_permute2x128_si256(previous, input, 0x21);
+		__m256i prev1 = _mm256_alignr_epi8(input, carried, 16 - 1);
+		__m256i special = _mm256_and_si256(
+			_mm256_and_si256(
+				_mm256_shuffle_epi8(prevHigh, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+				_mm256_shuffle_epi8(prevLow, _mm256_and_si256(prev1, nibble))),
+			_mm256_shuffle_epi8(currentHigh, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+
+		__m256i prev2 = _mm256_alignr_epi8(input, carried, 16 - 2);
+		__m256i prev3 = _mm256_alignr_epi8(input, carried, 16 - 3);
+		__m256i mustContinue = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+			_mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80))));
+		mustContinue = _mm256_and_si256(mustContinue, _mm256_set1_epi8(static_cast<char>(0x80)));
+
+		return _mm256_xor_si256(mustContinue, special);
+	}
+
+	// Teddy: bucket bits for each offset of the block at 'data', which must be readable
+	// for one register plus fingerprint - 1 bytes
+	TARGET_SSE42 __m128i teddyCandidates(const uint8_t* data, const __m128i* low, const __m128i* high, int fingerprint) {
+		const __m128i nibble = _mm_set1_epi8(0x0F);
+		__m128i buckets = _mm_set1_epi8(static_cast<char>(0xFF));
+		for (int k = 0; k < fingerprint; k++) {
+			__m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + k));
+			buckets = _mm_and_si128(buckets, _mm_and_si128(
+				_mm_shuffle_epi8(low[k], _mm_and_si128(input, nibble)),
+				_mm_shuffle_epi8(high[k], _mm_and_si128(_mm_srli_epi16(input, 4), nibble))));
+		}
+		return buckets;
+	}
+
+	TARGET_AVX2 __m256i teddyCandidates(const uint8_t* data, const __m256i* low, const __m256i* high, int fingerprint) {
+		const __m256i nibble = _mm256_set1_epi8(0x0F);
+		__m256i buckets = _mm256_set1_epi8(static_cast<char>(0xFF));
+		for (int k = 0; k < fingerprint; k++) {
+			__m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + k));
+			buckets = _mm256_and_si256(buckets, _mm256_and_si256(
+				_mm256_shuffle_epi8(low[k], _mm256_and_si256(input, nibble)),
+				_mm256_shuffle_epi8(high[k], _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble))));
+		}
+		return buckets;
+	}
+#endif
+}
+
+ContentFilter::ContentFilter()
+	: m_Kernel(DetectKernel())
+	, m_MaxTextBytes(0)
+	, m_MaxNameBytes(0)
+	, m_Fingerprint(0) {
+	memset(m_Low, 0, sizeof(m_Low));
+	memset(m_High, 0, sizeof(m_High));
+}
+
+void ContentFilter::Configure(size_t maxTextBytes, size_t maxNameBytes, const std::vector<std::string>& bannedTerms) {
+	m_MaxTextBytes = maxTextBytes;
+	m_MaxNameBytes = maxNameBytes;
+
+	m_Terms.clear();
+	for (const std::string& term : bannedTerms) {
+		if (term.empty()) {
+			continue;
+		}
+		std::string lower;
+		for (char c : term) {
+			lower.push_back(static_cast<char>(lowerAscii(static_cast<uint8_t>(c))));
+		}
+		m_Terms.push_back(lower);
+	}
+
+	// Sorted terms put shared prefixes in the same bucket, which keeps the masks selective
+	std::sort(m_Terms.begin(), m_Terms.end());
+	m_Terms.erase(std::unique(m_Terms.begin(), m_Terms.end()), m_Terms.end());
+
+	for (std::vector<uint16_t>& bucket : m_Buckets) {
+		bucket.clear();
+	}
+	m_Prefixes.clear();
+	m_PrefixMasks.clear();
+	memset(m_Low, 0, sizeof(m_Low));
+	memset(m_High, 0, sizeof(m_High));
+
+	m_Fingerprint = 0;
+	if (m_Terms.empty()) {
+		return;
+	}
+
+	m_Fingerprint = MAX_FINGERPRINT;
+	for (const std::string& term : m_Terms) {
+		m_Fingerprint = (std::min)(m_Fingerprint, static_cast<int>(term.size()));
+	}
+
+	for (size_t t = 0; t < m_Terms.size(); t++) {
+		int bucket = static_cast<int>(t * BUCKETS / m_Terms.size());
+		uint8_t bit = static_cast<uint8_t>(1 << bucket);
+		m_Buckets[bucket].push_back(static_cast<uint16_t>(t));
+
+		const std::string& term = m_Terms[t];
+		size_t prefixLength = (std::min)(term.size(), sizeof(uint32_t));
+		uint32_t prefix = 0;
+		uint32_t mask = 0;
+		memcpy(&prefix, term.data(), prefixLength);
+		memset(&mask, 0xFF, prefixLength);
+		m_Prefixes.push_back((prefix | FOLD_CASE) & mask);
+		m_PrefixMasks.push_back(mask);
+
+		for (int k = 0; k < m_Fingerprint; k++) {
+			uint8_t c = static_cast<uint8_t>(m_Terms[t][k]);
+			m_Low[k][c & 0x0F] |= bit;
+			m_High[k][c >> 4] |= bit;
+
+			// Accept the upper-case letter too; the two cases differ only in the high nibble
+			if (c >= 'a' && c <= 'z') {
+				m_High[k][(c - ('a' - 'A')) >> 4] |= bit;
+			}
+		}
+	}
+}
+
+ContentFilter::Verdict ContentFilter::Check(std::string_view text, std::string_view name) const {
+	if ((m_MaxTextBytes > 0 && text.size() > m_MaxTextBytes) || (m_MaxNameBytes > 0 && name.size() > m_MaxNameBytes)) {
+		return Verdict::TooLong;
+	}
+	if (!IsValidUtf8(text) || !IsValidUtf8(name)) {
+		return Verdict::InvalidUtf8;
+	}
+	if (ContainsBanned(text) || ContainsBanned(name)) {
+		return Verdict::Banned;
+	}
+	return Verdict::Ok;
+}
+
+bool ContentFilter::IsValidUtf8(std::string_view text) const {
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+
+	switch (m_Kernel) {
+#if defined(CONTENT_FILTER_X86)
+	case Kernel::Avx2:
+		return ValidateAvx2(data, text.size());
+	case Kernel::Sse42:
+		return ValidateSse42(data, text.size());
+#endif
+	default:
+		return ValidateScalar(data, text.size());
+	}
+}
+
+bool ContentFilter::ContainsBanned(std::string_view text) const {
+	if (m_Fingerprint == 0 || text.size() < static_cast<size_t>(m_Fingerprint)) {
+		return false;
+	}
+
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+
+	switch (m_Kernel) {
+#if defined(CONTENT_FILTER_X86)
+	case Kernel::Avx2:
+		return SearchAvx2(data, text.size());
+	case Kernel::Sse42:
+		return SearchSse42(data, text.size());
+#endif
+	default:
+		return SearchScalar(data, text.size());
+	}
+}
+
+ContentFilter::Kernel ContentFilter::DetectKernel() {
+#if defined(CONTENT_FILTER_X86)
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse42 = (info[2] & (1 << 20)) != 0;
+
+	// AVX state must also be enabled by the OS (OSXSAVE, then XMM and YMM in XCR0)
+	bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+	bool avx2 = false;
+	if (avx && maxLeaf >= 7) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool sse42 = __builtin_cpu_supports("sse4.2");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+	if (avx2) {
+		return Kernel::Avx2;
+	}
+	if (sse42) {
+		return Kernel::Sse42;
+	}
+#endif
+	return Kernel::Scalar;
+}
+
+const char* ContentFilter::KernelName(Kernel kernel) {
+	switch (kernel) {
+	case Kernel::Avx2: return "AVX2";
+	case Kernel::Sse42: return "SSE4.2";
+	default: return "scalar";
+	}
+}
+
+const char* ContentFilter::VerdictText(Verdict verdict) {
+	switch (verdict) {
+	case Verdict::TooLong: return "it is too long";
+	case Verdict::InvalidUtf8: return "it is not valid UTF-8";
+	case Verdict::Banned: return "it contains a banned term";
+	default: return "ok";
+	}
+}
+
+bool ContentFilter::ValidateScalar(const uint8_t* data, size_t length) const {
+	size_t i = 0;
+	while (i < length) {
+		// Skip ASCII runs a word at a time
+		if (length - i >= 8 && isAscii(data + i, 8)) {
+			i += 8;
+			continue;
+		}
+
+		uint8_t lead = data[i];
+		if (lead < 0x80) {
+			i++;
+			continue;
+		}
+
+		// Continuation count and the allowed range of the second byte (Unicode table 3-7)
+		size_t count;
+		uint8_t low = 0x80;
+		uint8_t high = 0xBF;
+		if (lead >= 0xC2 && lead <= 0xDF) {
+			count = 1;
+		}
+		else if (lead == 0xE0) {
+			count = 2;
+			low = 0xA0;
+		}
+		else if (lead == 0xED) {
+			count = 2;
+			high = 0x9F;
+		}
+		else if (lead >= 0xE1 && lead <= 0xEF) {
+			count = 2;
+		}
+		else if (lead == 0xF0) {
+			count = 3;
+			low = 0x90;
+		}
+		else if (lead >= 0xF1 && lead <= 0xF3) {
+			count = 3;
+		}
+		else if (lead == 0xF4) {
+			count = 3;
+			high = 0x8F;
+		}
+		else {
+			return false;
+		}
+
+		if (length - i - 1 < count || data[i + 1] < low || data[i + 1] > high) {
+			return false;
+		}
+		for (size_t k = 2; k <= count; k++) {
+			if ((data[i + k] & 0xC0) != 0x80) {
+				return false;
+			}
+		}
+		i += count + 1;
+	}
+	return true;
+}
+
+bool ContentFilter::SearchScalar(const uint8_t* data, size_t length) const {
+	for (size_t i = 0; i + m_Fingerprint <= length; i++) {
+		uint8_t buckets = 0xFF;
+		for (int k = 0; k < m_Fingerprint; k++) {
+			uint8_t c = data[i + k];
+			buckets &= m_Low[k][c & 0x0F] & m_High[k][c >> 4];
+		}
+		if (buckets != 0 && Verify(data, length, i, buckets)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ContentFilter::Verify(const uint8_t* data, size_t length, size_t position, uint8_t buckets) const {
+	// Most candidates fail on the first few bytes: compare those as one word first
+	uint32_t window = 0;
+	memcpy(&window, data + position, (std::min)(length - position, sizeof(window)));
+	window |= FOLD_CASE;
+
+	for (int bucket = 0; bucket < BUCKETS; bucket++) {
+		if ((buckets & (1 << bucket)) == 0) {
+			continue;
+		}
+
+		for (uint16_t index : m_Buckets[bucket]) {
+			const std::string& term = m_Terms[index];
+			if (term.size() > length - position || (window & m_PrefixMasks[index]) != m_Prefixes[index]) {
+				continue;
+			}
+
+			size_t k = 0;
+			while (k < term.size() && lowerAscii(data[position + k]) == static_cast<uint8_t>(term[k])) {
+				k++;
+			}
+			if (k == term.size()) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool ContentFilter::VerifyLanes(const uint8_t* lanes, size_t count, const uint8_t* data, size_t length, size_t base) const {
+	for (size_t j = 0; j < count && base + j < length; j++) {
+		if (lanes[j] != 0 && Verify(data, length, base + j, lanes[j])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+#if defined(CONTENT_FILTER_X86)
+
+TARGET_SSE42 bool ContentFilter::ValidateSse42(const uint8_t* data, size_t length) const {
+	__m128i previous = _mm_setzero_si128();
+	__m128i incomplete = _mm_setzero_si128();
+	__m128i error = _mm_setzero_si128();
+	const __m128i limit = _mm_load_si128(reinterpret_cast<const __m128i*>(INCOMPLETE_LIMIT));
+
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16) {
+		__m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+
+		// An ASCII block is fine unless the one before it stopped mid-sequence
+		if (_mm_movemask_epi8(input) == 0) {
+			error = _mm_or_si128(error, incomplete);
+			incomplete = _mm_setzero_si128();
+		}
+		else {
+			error = _mm_or_si128(error, utf8Errors(input, previous));
+			incomplete = _mm_subs_epu8(input, limit);
+		}
+		previous = input;
+	}
+
+	if (!_mm_testz_si128(error, error)) {
+		return false;
+	}
+
+	size_t resume = resumePoint(data, i);
+	return ValidateScalar(data + resume, length - resume);
+}
+
+TARGET_AVX2 bool ContentFilter::ValidateAvx2(const uint8_t* data, size_t length) const {
+	__m256i previous = _mm256_setzero_si256();
+	__m256i incomplete = _mm256_setzero_si256();
+	__m256i error = _mm256_setzero_si256();
+
+	// Only the last three bytes of the upper lane matter
+	const __m256i limit = _mm256_inserti128_si256(_mm256_set1_epi8(static_cast<char>(0xFF)),
+		_mm_load_si128(reinterpret_cast<const __m128i*>(INCOMPLETE_LIMIT)), 1);
+
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32) {
+		__m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+
+		if (_mm256_movemask_epi8(input) == 0) {
+			error = _mm256_or_si256(error, incomplete);
+			incomplete = _mm256_setzero_si256();
+		}
+		else {
+			error = _mm256_or_si256(error, utf8Errors(input, previous));
+			incomplete = _mm256_subs_epu8(input, limit);
+		}
+		previous = input;
+	}
+
+	if (!_mm256_testz_si256(error, error)) {
+		return false;
+	}
+
+	size_t resume = resumePoint(data, i);
+	return ValidateScalar(data + resume, length - resume);
+}
+
+TARGET_SSE42 bool ContentFilter::SearchSse42(const uint8_t* data, size_t length) const {
+	__m128i low[MAX_FINGERPRINT];
+	__m128i high[MAX_FINGERPRINT];
+	for (int k = 0; k < m_Fingerprint; k++) {
+		low[k] = _mm_load_si128(reinterpret_cast<const __m128i*>(m_Low[k]));
+		high[k] = _mm_load_si128(reinterpret_cast<const __m128i*>(m_High[k]));
+	}
+
+	alignas(16) uint8_t lanes[16];
+	size_t i = 0;
+	for (; i + 16 + m_Fingerprint - 1 <= length; i += 16) {
+		__m128i buckets = teddyCandidates(data + i, low, high, m_Fingerprint);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(buckets, _mm_setzero_si128())) != 0xFFFF) {
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes), buckets);
+			if (VerifyLanes(lanes, 16, data, length, i)) {
+				return true;
+			}
+		}
+	}
+
+	// The rest through a zero-padded copy; every offset where a term still fits is below 16
+	if (i < length) {
+		uint8_t block[16 + MAX_FINGERPRINT] = {};
+		memcpy(block, data + i, (std::min)(length - i, sizeof(block)));
+		_mm_store_si128(reinterpret_cast<__m128i*>(lanes), teddyCandidates(block, low, high, m_Fingerprint));
+		return VerifyLanes(lanes, 16, data, length, i);
+	}
+	return false;
+}
+
+TARGET_AVX2 bool ContentFilter::SearchAvx2(const uint8_t* data, size_t length) const {
+	__m256i low[MAX_FINGERPRINT];
+	__m256i high[MAX_FINGERPRINT];
+	for (int k = 0; k < m_Fingerprint; k++) {
+		low[k] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(m_Low[k])));
+		high[k] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(m_High[k])));
+	}
+
+	alignas(32) uint8_t lanes[32];
+	size_t i = 0;
+	for (; i + 32 + m_Fingerprint - 1 <= length; i += 32) {
+		__m256i buckets = teddyCandidates(data + i, low, high, m_Fingerprint);
+		if (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(buckets, _mm256_setzero_si256()))) != 0xFFFFFFFFu) {
+			_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), buckets);
+			if (VerifyLanes(lanes, 32, data, length, i)) {
+				return true;
+			}
+		}
+	}
+
+	if (i < length) {
+		uint8_t block[32 + MAX_FINGERPRINT] = {};
+		memcpy(block, data + i, (std::min)(length - i, sizeof(block)));
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), teddyCandidates(block, low, high, m_Fingerprint));
+		return VerifyLanes(lanes, 32, data, length, i);
+	}
+	return false;
+}
+
+#endif
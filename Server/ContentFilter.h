@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+
+// Checks client-supplied text before it is fanned out: byte-length limits, well-formed
+// UTF-8, and a list of banned terms matched as case-insensitive (ASCII) substrings.
+//
+// Both scans run over 16 or 32 bytes at a time when the CPU has SSE4.2 or AVX2, chosen
+// once at startup, with a scalar fallback that gives the same answers:
+//  - UTF-8 is validated with nibble lookup tables: every byte is classified from its own
+//    high nibble and the previous byte's two nibbles, and the three classes are ANDed,
+//    so any bad sequence leaves a non-zero bit.
+//  - Banned terms use the Teddy scheme. Terms are spread over 8 buckets, and a few
+//    leading bytes of each term are folded into per-position nibble masks. One shuffle
+//    per nibble then marks every offset where some bucket's prefix could start, and
+//    only those offsets are compared against the bucket's terms.
+class ContentFilter {
+public:
+	enum class Kernel { Scalar, Sse42, Avx2 };
+	enum class Verdict { Ok, TooLong, InvalidUtf8, Banned };
+
+	ContentFilter();
+
+	// A limit of 0 means unlimited. Empty terms are ignored.
+	void Configure(size_t maxTextBytes, size_t maxNameBytes, const std::vector<std::string>& bannedTerms);
+
+	// Check a message body and the sender's name against every rule
+	Verdict Check(std::string_view text, std::string_view name) const;
+
+	bool IsValidUtf8(std::string_view text) const;
+	bool ContainsBanned(std::string_view text) const;
+
+	// The best kernel this CPU (and OS) supports
+	static Kernel DetectKernel();
+	static const char* KernelName(Kernel kernel);
+	static const char* VerdictText(Verdict verdict);
+
+	Kernel GetKernel() const { return m_Kernel; }
+	void SetKernel(Kernel kernel) { m_Kernel = kernel; }	// Only to compare kernels; defaults to DetectKernel()
+	size_t TermCount() const { return m_Terms.size(); }
+
+private:
+	static const int BUCKETS = 8;
+	static const int MAX_FINGERPRINT = 4;	// Leading bytes of each term in the nibble masks
+
+	bool ValidateScalar(const uint8_t* data, size_t length) const;
+	bool ValidateSse42(const uint8_t* data, size_t length) const;
+	bool ValidateAvx2(const uint8_t* data, size_t length) const;
+
+	bool SearchScalar(const uint8_t* data, size_t length) const;
+	bool SearchSse42(const uint8_t* data, size_t length) const;
+	bool SearchAvx2(const uint8_t* data, size_t length) const;
+
+	// Compare the terms of every bucket in 'buckets' against 'data' at 'position'
+	bool Verify(const uint8_t* data, size_t length, size_t position, uint8_t buckets) const;
+
+	// Verify every non-zero lane of a block kernel's candidates; lane j is offset base + j
+	bool VerifyLanes(const uint8_t* lanes, size_t count, const uint8_t* data, size_t length, size_t base) const;
+
+	Kernel m_Kernel;
+	size_t m_MaxTextBytes;
+	size_t m_MaxNameBytes;
+
+	std::vector<std::string> m_Terms;				// Lower-cased
+	std::vector<uint16_t> m_Buckets[BUCKETS];		// Indices into m_Terms
+	std::vector<uint32_t> m_Prefixes;				// Per term: its first four bytes, case-folded
+	std::vector<uint32_t> m_PrefixMasks;			// Per term: which of those bytes it has
+	int m_Fingerprint;								// Bytes used per term, 0 = no terms
+
+	// m_Low[k][n]: bit b set if a term in bucket b can have low nibble n at byte k. Same for m_High.
+	alignas(16) uint8_t m_Low[MAX_FINGERPRINT][16];
+	alignas(16) uint8_t m_High[MAX_FINGERPRINT][16];
+};
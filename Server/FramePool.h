@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stddef.h>
+#include <new>
+#include <vector>
+#include <stdio.h>
+
+// Size-class free-list allocator for coroutine frames.
+// Every connection owns one long-lived coroutine frame, so with many sessions the general
+// purpose heap would see one mid-sized allocation per connect/disconnect. Frames are
+// carved out of large chunks instead and recycled through per-size free lists.
+// Frames larger than the biggest class still work but come from the heap; each new largest
+// one is logged so a build whose handler frames outgrow the classes shows up straight away.
+// Not thread-safe: the reactor thread is the only one that creates or destroys coroutines.
+class FramePool {
+public:
+	static void* Allocate(size_t size) {
+		size_t sizeClass = SizeClass(size);
+		if (sizeClass >= SIZE_CLASSES) {
+			Instance().CountHeapFrame(size);
+			return ::operator new(size);
+		}
+
+		FreeBlock*& head = Instance().m_FreeLists[sizeClass];
+		if (head == nullptr) {
+			Instance().Refill(sizeClass);
+		}
+
+		FreeBlock* block = head;
+		head = block->next;
+		return block;
+	}
+
+	static void Free(void* pointer, size_t size) {
+		size_t sizeClass = SizeClass(size);
+		if (sizeClass >= SIZE_CLASSES) {
+			::operator delete(pointer);
+			return;
+		}
+
+		FreeBlock* block = static_cast<FreeBlock*>(pointer);
+		FreeBlock*& head = Instance().m_FreeLists[sizeClass];
+		block->next = head;
+		head = block;
+	}
+
+private:
+	// Cache-line sized classes: 64, 128, ... 8192 bytes. A client handler's frame, Session
+	// included, is 600 bytes with g++ at -O0 and -O2; the headroom is for debug builds,
+	// whose frames keep every temporary.
+	static const size_t GRANULARITY = 64;
+	static const size_t SIZE_CLASSES = 128;
+	static const size_t BLOCKS_PER_CHUNK = 256;
+
+	struct FreeBlock {
+		FreeBlock* next;
+	};
+
+	FramePool() : m_HeapFrames(0), m_LargestHeapFrame(0) {
+		for (size_t i = 0; i < SIZE_CLASSES; i++) {
+			m_FreeLists[i] = nullptr;
+		}
+	}
+
+	~FramePool() {
+		for (char* chunk : m_Chunks) {
+			::operator delete(chunk);
+		}
+	}
+
+	static FramePool& Instance() {
+		static FramePool pool;
+		return pool;
+	}
+
+	static size_t SizeClass(size_t size) {
+		return (size + GRANULARITY - 1) / GRANULARITY - 1;
+	}
+
+	void CountHeapFrame(size_t size) {
+		m_HeapFrames++;
+		if (size > m_LargestHeapFrame) {
+			m_LargestHeapFrame = size;
+			printf("FramePool: %zu-byte coroutine frame is over the %zu-byte size classes, allocating from the heap (%zu such frames so far)\n",
+				size, SIZE_CLASSES * GRANULARITY, m_HeapFrames);
+		}
+	}
+
+	void Refill(size_t sizeClass) {
+		size_t blockSize = (sizeClass + 1) * GRANULARITY;
+		char* chunk = static_cast<char*>(::operator new(blockSize * BLOCKS_PER_CHUNK));
+		m_Chunks.push_back(chunk);
+
+		for (size_t i = 0; i < BLOCKS_PER_CHUNK; i++) {
+			FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + i * blockSize);
+			block->next = m_FreeLists[sizeClass];
+			m_FreeLists[sizeClass] = block;
+		}
+	}
+
+	FreeBlock* m_FreeLists[SIZE_CLASSES];
+	std::vector<char*> m_Chunks;
+	size_t m_HeapFrames;
+	size_t m_LargestHeapFrame;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+// Consistent hash ring mapping keys (room names) to cluster nodes.
+// Each node is placed at many virtual points so rooms spread evenly, and every
+// node computes the same owner for a key without talking to the others.
+class HashRing {
+public:
+	HashRing(int nodeCount, int virtualNodes = 128) {
+		for (int node = 0; node < nodeCount; node++) {
+			for (int v = 0; v < virtualNodes; v++) {
+				m_Points.push_back(std::make_pair(Hash("node" + std::to_string(node) + "#" + std::to_string(v)), node));
+			}
+		}
+		std::sort(m_Points.begin(), m_Points.end());
+	}
+
+	// The first node clockwise from the key's hash
+	int Owner(const std::string& key) const {
+		if (m_Points.empty()) {
+			return 0;
+		}
+
+		auto it = std::lower_bound(m_Points.begin(), m_Points.end(), std::make_pair(Hash(key), 0));
+		if (it == m_Points.end()) {
+			it = m_Points.begin();
+		}
+		return it->second;
+	}
+
+	// 64-bit FNV-1a with a final avalanche, since ring points differ only in a few digits
+	static uint64_t Hash(const std::string& key) {
+		uint64_t hash = 14695981039346656037ULL;
+		for (char c : key) {
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 1099511628211ULL;
+		}
+
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+private:
+	std::vector<std::pair<uint64_t, int>> m_Points;
+};
@@ -0,0 +1,199 @@
+#include "Reactor.h"
+
+#include <stdio.h>
+
+namespace {
+	const size_t RECV_BUFFER_SIZE = 64 * 1024;
+}
+
+Reactor::Reactor()
+	: m_Running(false)
+	, m_Turn(0)
+	, m_Now(Clock::now())
+	, m_HandlerCount(0)
+	, m_RecvBuffer(RECV_BUFFER_SIZE) {
+}
+
+Reactor::~Reactor() {
+}
+
+void Reactor::Register(PollHandler* handler) {
+	int slot;
+	if (!m_FreeSlots.empty()) {
+		slot = m_FreeSlots.back();
+		m_FreeSlots.pop_back();
+		m_Handlers[slot] = handler;
+	}
+	else {
+		slot = static_cast<int>(m_Handlers.size());
+		m_Handlers.push_back(handler);
+	}
+
+	handler->m_ReactorSlot = slot;
+	m_HandlerCount++;
+}
+
+void Reactor::Unregister(PollHandler* handler) {
+	int slot = handler->m_ReactorSlot;
+	if (slot < 0 || m_Handlers[slot] != handler) {
+		return;
+	}
+
+	// The slot may still have revents pending in this turn's poll results,
+	// so it only becomes reusable once the turn is over.
+	m_Handlers[slot] = nullptr;
+	m_ReleasedSlots.push_back(slot);
+	handler->m_ReactorSlot = -1;
+	m_HandlerCount--;
+}
+
+void Reactor::Schedule(std::coroutine_handle<> handle) {
+	m_Scheduled.push_back(handle);
+}
+
+void Reactor::AddTimer(std::chrono::milliseconds interval, std::function<void()> callback) {
+	Timer timer;
+	timer.interval = interval;
+	timer.due = Clock::now() + interval;
+	timer.callback = callback;
+	m_Timers.push_back(timer);
+}
+
+void Reactor::RunTimers() {
+	for (Timer& timer : m_Timers) {
+		if (timer.due <= m_Now) {
+			timer.due = m_Now + timer.interval;
+			timer.callback();
+		}
+	}
+
+	// Sleepers are few (reconnect back-offs), so a linear scan is fine
+	for (size_t i = 0; i < m_Sleepers.size();) {
+		if (m_Sleepers[i].due <= m_Now) {
+			Schedule(m_Sleepers[i].handle);
+			m_Sleepers[i] = m_Sleepers.back();
+			m_Sleepers.pop_back();
+		}
+		else {
+			i++;
+		}
+	}
+}
+
+int Reactor::PollTimeout() const {
+	if (!m_Scheduled.empty() || !m_DeferredSlots.empty()) {
+		return 0;
+	}
+
+	int timeout = -1;
+	auto consider = [&](Clock::time_point due) {
+		auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(due - m_Now).count() + 1;
+		if (wait < 0) {
+			wait = 0;
+		}
+		if (timeout < 0 || wait < timeout) {
+			timeout = static_cast<int>(wait);
+		}
+	};
+
+	for (const Timer& timer : m_Timers) {
+		consider(timer.due);
+	}
+	for (const Sleeper& sleeper : m_Sleepers) {
+		consider(sleeper.due);
+	}
+	return timeout;
+}
+
+void Reactor::RunScheduled() {
+	// Coroutines resumed here may schedule more work; that waits for the next turn.
+	m_ResumeBatch.swap(m_Scheduled);
+	for (std::coroutine_handle<> handle : m_ResumeBatch) {
+		handle.resume();
+	}
+	m_ResumeBatch.clear();
+}
+
+void Reactor::Run() {
+	m_Running = true;
+
+	while (m_Running) {
+		m_Turn++;
+		m_Now = Clock::now();
+
+		m_FreeSlots.insert(m_FreeSlots.end(), m_ReleasedSlots.begin(), m_ReleasedSlots.end());
+		m_ReleasedSlots.clear();
+
+		RunTimers();
+		RunScheduled();
+
+		// Collect the interest set. Handlers with nothing to wait for stay out of the poll.
+		m_PollFds.clear();
+		m_PollSlots.clear();
+		m_DeferredSlots.clear();
+
+		for (size_t slot = 0; slot < m_Handlers.size(); slot++) {
+			PollHandler* handler = m_Handlers[slot];
+			if (handler == nullptr) {
+				continue;
+			}
+
+			if (handler->HasDeferredWork()) {
+				m_DeferredSlots.push_back(static_cast<int>(slot));
+			}
+
+			short events = handler->PollEvents();
+			if (events == 0) {
+				continue;
+			}
+
+			WSAPOLLFD fd;
+			fd.fd = handler->Socket();
+			fd.events = events;
+			fd.revents = 0;
+			m_PollFds.push_back(fd);
+			m_PollSlots.push_back(static_cast<int>(slot));
+		}
+
+		int timeout = PollTimeout();
+		int count = 0;
+
+		if (m_PollFds.empty()) {
+			if (timeout != 0) {
+				::Sleep(1);
+			}
+		}
+		else {
+			count = WSAPoll(m_PollFds.data(), static_cast<ULONG>(m_PollFds.size()), timeout);
+			if (count == SOCKET_ERROR) {
+				printf("WSAPoll failed with error %d\n", WSAGetLastError());
+				::Sleep(1);
+				continue;
+			}
+		}
+
+		for (size_t i = 0; i < m_PollFds.size() && count > 0; i++) {
+			short revents = m_PollFds[i].revents;
+			if (revents == 0) {
+				continue;
+			}
+
+			count--;
+
+			// Null if an earlier handler in this turn closed it
+			PollHandler* handler = m_Handlers[m_PollSlots[i]];
+			if (handler != nullptr) {
+				handler->OnPollEvents(revents);
+			}
+		}
+
+		// Deferred work runs after socket events, so a handler that used up its budget
+		// last turn goes behind everyone who was waiting on the network.
+		for (int slot : m_DeferredSlots) {
+			PollHandler* handler = m_Handlers[slot];
+			if (handler != nullptr && handler->HasDeferredWork()) {
+				handler->OnPollEvents(0);
+			}
+		}
+	}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <Windows.h>
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+
+#include <chrono>
+#include <coroutine>
+#include <functional>
+#include <vector>
+#include <stdint.h>
+
+// Anything the reactor can poll: a socket plus the events it currently cares about
+class PollHandler {
+public:
+	virtual ~PollHandler() { }
+
+	virtual SOCKET Socket() const = 0;
+	virtual short PollEvents() const = 0;
+
+	// True if the handler has work it could do without any socket event, e.g. input it
+	// already received but deferred to a later turn. It then gets OnPollEvents(0) this turn.
+	virtual bool HasDeferredWork() const { return false; }
+
+	// Called with the WSAPoll revents. The handler may destroy itself inside this call,
+	// so implementations must not touch 'this' after resuming a coroutine.
+	virtual void OnPollEvents(short revents) = 0;
+
+	int m_ReactorSlot = -1;
+};
+
+// Single-threaded non-blocking event loop built on WSAPoll.
+// Sockets are registered once; the interest set is re-read from each handler every turn,
+// so handlers never have to notify the reactor when they start or stop waiting.
+class Reactor {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	Reactor();
+	~Reactor();
+
+	void Register(PollHandler* handler);
+	void Unregister(PollHandler* handler);
+
+	// Resume 'handle' on the next turn, outside whatever call stack is running now
+	void Schedule(std::coroutine_handle<> handle);
+
+	// Call 'callback' every 'interval' from the reactor thread
+	void AddTimer(std::chrono::milliseconds interval, std::function<void()> callback);
+
+	// co_await Sleep(delay): resume the coroutine on the first turn after 'delay'
+	struct SleepAwaiter {
+		Reactor& reactor;
+		std::chrono::milliseconds delay;
+
+		bool await_ready() const { return delay.count() <= 0; }
+		void await_suspend(std::coroutine_handle<> handle) { reactor.m_Sleepers.push_back(Sleeper{ reactor.m_Now + delay, handle }); }
+		void await_resume() const { }
+	};
+
+	SleepAwaiter Sleep(std::chrono::milliseconds delay) { return SleepAwaiter{ *this, delay }; }
+
+	// Run until Stop() is called from a handler
+	void Run();
+	void Stop() { m_Running = false; }
+
+	// Scratch space for recv(); valid until the handler returns
+	std::vector<char>& RecvBuffer() { return m_RecvBuffer; }
+
+	size_t HandlerCount() const { return m_HandlerCount; }
+
+	// Incremented once per loop turn; handlers use it to budget their work per turn
+	uint64_t Turn() const { return m_Turn; }
+
+	// Time the current turn started, so hot paths don't read the clock per message
+	Clock::time_point Now() const { return m_Now; }
+
+private:
+	struct Timer {
+		std::chrono::milliseconds interval;
+		Clock::time_point due;
+		std::function<void()> callback;
+	};
+
+	struct Sleeper {
+		Clock::time_point due;
+		std::coroutine_handle<> handle;
+	};
+
+	void RunScheduled();
+	void RunTimers();
+	int PollTimeout() const;
+
+	bool m_Running;
+	uint64_t m_Turn;
+	Clock::time_point m_Now;
+
+	std::vector<PollHandler*> m_Handlers;		// Indexed by slot, null if free
+	std::vector<int> m_FreeSlots;				// Reusable from the next turn
+	std::vector<int> m_ReleasedSlots;			// Freed this turn
+	size_t m_HandlerCount;
+
+	std::vector<WSAPOLLFD> m_PollFds;
+	std::vector<int> m_PollSlots;				// m_PollFds[i] belongs to m_Handlers[m_PollSlots[i]]
+	std::vector<int> m_DeferredSlots;			// Handlers with deferred work this turn
+
+	std::vector<std::coroutine_handle<>> m_Scheduled;
+	std::vector<std::coroutine_handle<>> m_ResumeBatch;
+
+	std::vector<Timer> m_Timers;
+	std::vector<Sleeper> m_Sleepers;
+
+	std::vector<char> m_RecvBuffer;
+};
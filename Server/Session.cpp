@@ -0,0 +1,331 @@
+#include "Session.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <stdio.h>
+
+namespace {
+	// Reads per readiness event, so one busy connection can't starve the rest of the loop
+	const int MAX_READS_PER_EVENT = 4;
+
+	// Write() suspends the handler above this many unsent bytes
+	const size_t SEND_HIGH_WATER = 256 * 1024;
+
+	// A peer that falls this far behind is not reading; drop it rather than buffer forever
+	const size_t SEND_HARD_LIMIT = 8 * 1024 * 1024;
+}
+
+Session::Session(Reactor& reactor, SOCKET socket, size_t turnQuantum)
+	: m_BroadcastEpoch(0)
+	, m_Throttled(false)
+	, m_Reactor(reactor)
+	, m_Socket(socket)
+	, m_Closed(false)
+	, m_Deficit(0)
+	, m_DeficitTurn(0)
+	, m_TurnQuantum(turnQuantum)
+	, m_Deferred(false)
+	, m_InputClosed(false)
+	, m_RingFull(false)
+	, m_SendOffset(0)
+	, m_ReadTarget(nullptr)
+	, m_FlushWaiting(false) {
+	m_Reactor.Register(this);
+}
+
+Session::~Session() {
+	m_Reactor.Unregister(this);
+	closesocket(m_Socket);
+}
+
+void Session::Enqueue(const std::vector<uint8_t>& frame) {
+	if (m_Closed) {
+		return;
+	}
+
+	if (m_SendOffset == m_SendBuffer.size()) {
+		m_SendBuffer.clear();
+		m_SendOffset = 0;
+	}
+
+	// Nothing is sent here: the reactor flushes everything queued this turn with one send().
+	m_SendBuffer.insert(m_SendBuffer.end(), frame.begin(), frame.end());
+
+	if (m_SendBuffer.size() - m_SendOffset > SEND_HARD_LIMIT) {
+		printf("Disconnecting stalled client with Socket: %d\n", (int)m_Socket);
+		Fail();
+	}
+}
+
+void Session::Fail() {
+	if (m_Closed) {
+		return;
+	}
+
+	m_Closed = true;
+
+	// Resume from the reactor, not from inside whoever noticed the failure:
+	// the handler will tear this session down, and the caller may still be using it.
+	if (m_Waiter) {
+		m_Reactor.Schedule(m_Waiter);
+		m_Waiter = nullptr;
+		m_ReadTarget = nullptr;
+		m_FlushWaiting = false;
+	}
+}
+
+bool Session::IsBackedUp() const {
+	return m_SendBuffer.size() - m_SendOffset > SEND_HIGH_WATER;
+}
+
+bool Session::TryReadFrame(ChatMessage& message) {
+	if (m_Closed) {
+		return true;
+	}
+
+	// First visit this turn: grant a quantum. Unused credit doesn't carry over, debt does.
+	if (m_DeficitTurn != m_Reactor.Turn()) {
+		m_DeficitTurn = m_Reactor.Turn();
+		m_Deficit = (std::min)(m_Deficit, (int64_t)0) + static_cast<int64_t>(m_TurnQuantum);
+	}
+
+	m_Deferred = false;
+
+	if (m_Channel && !m_Decoder.HasFrame()) {
+		ReadRing();
+	}
+
+	if (!m_Decoder.HasFrame()) {
+		// Frames that arrived together with the peer's FIN are still delivered first
+		if (m_InputClosed) {
+			Fail();
+			return true;
+		}
+		return false;
+	}
+
+	if (m_Deficit <= 0) {
+		// Out of budget with input already waiting: come back next turn without polling for it
+		m_Deferred = true;
+		return false;
+	}
+
+	try {
+		m_Decoder.Next(message);
+		m_Deficit -= message.header.packetSize;
+		return true;
+	}
+	catch (const std::runtime_error& e) {
+		printf("Dropping client with Socket %d: %s\n", (int)m_Socket, e.what());
+		Fail();
+		return true;
+	}
+}
+
+void Session::Suspend(std::coroutine_handle<> handle, ChatMessage* readTarget) {
+	m_Waiter = handle;
+	m_ReadTarget = readTarget;
+}
+
+short Session::PollEvents() const {
+	if (m_Closed) {
+		return 0;
+	}
+
+	bool sendPending = m_SendOffset < m_SendBuffer.size();
+
+	short events = 0;
+	if (m_ReadTarget != nullptr && !m_Deferred && !m_InputClosed) {
+		events |= POLLRDNORM;
+	}
+
+	if (m_Channel) {
+		// The socket only carries doorbells: wait on it while the outbound ring is full,
+		// and take a writable turn to copy pending output into the ring otherwise.
+		if (!m_InputClosed) {
+			events |= POLLRDNORM;
+		}
+		if (sendPending && !m_RingFull) {
+			events |= POLLWRNORM;
+		}
+	}
+	else if (sendPending) {
+		events |= POLLWRNORM;
+	}
+	return events;
+}
+
+void Session::OnPollEvents(short revents) {
+	if (m_Channel && (revents & (POLLRDNORM | POLLHUP | POLLERR))) {
+		ReadSocket();		// Doorbells only; ring data is pulled by TryReadFrame()
+	}
+
+	if (revents & (POLLWRNORM | POLLHUP | POLLERR) || m_Channel) {
+		WriteSocket();
+	}
+
+	if (m_Closed || !m_Waiter) {
+		return;
+	}
+
+	bool resume = false;
+
+	if (m_ReadTarget != nullptr) {
+		if (!m_Channel && (revents & (POLLRDNORM | POLLHUP | POLLERR))) {
+			ReadSocket();
+		}
+		resume = TryReadFrame(*m_ReadTarget);
+	}
+	else if (m_FlushWaiting) {
+		resume = m_SendOffset == m_SendBuffer.size();
+	}
+	else {
+		resume = !IsBackedUp();
+	}
+
+	// Fail() may already have scheduled the waiter
+	if (!resume || !m_Waiter) {
+		return;
+	}
+
+	std::coroutine_handle<> waiter = m_Waiter;
+	m_Waiter = nullptr;
+	m_ReadTarget = nullptr;
+	m_FlushWaiting = false;
+
+	// The handler may finish and destroy this session; nothing may follow the resume.
+	waiter.resume();
+}
+
+void Session::ReadSocket() {
+	std::vector<char>& recvBuffer = m_Reactor.RecvBuffer();
+
+	if (m_InputClosed) {
+		return;
+	}
+
+	for (int i = 0; i < MAX_READS_PER_EVENT; i++) {
+		// Socket recv result checks
+		// -1 : SOCKET_ERROR -- Get more info received from WSAGetLastError() after
+		//  0 : Client disconnected
+		// >0 : The number of bytes received.
+		int result = recv(m_Socket, recvBuffer.data(), static_cast<int>(recvBuffer.size()), 0);
+		if (result == SOCKET_ERROR) {
+			int errorCode = WSAGetLastError();
+			if (errorCode != WSAEWOULDBLOCK) {
+				if (errorCode != WSAECONNRESET && errorCode != WSAECONNREFUSED) {
+					printf("recv failed with error %d\n", errorCode);
+				}
+				Fail();
+			}
+			return;
+		}
+
+		if (result == 0) {
+			m_InputClosed = true;
+			return;
+		}
+
+		if (!m_Channel) {
+			m_Decoder.Append(recvBuffer.data(), result);
+		}
+
+		if (result < static_cast<int>(recvBuffer.size())) {
+			return;		// Drained what the kernel had
+		}
+	}
+}
+
+void Session::WriteSocket() {
+	if (m_Channel) {
+		WriteRing();
+		return;
+	}
+
+	while (m_SendOffset < m_SendBuffer.size()) {
+		int length = static_cast<int>(m_SendBuffer.size() - m_SendOffset);
+		int result = send(m_Socket, reinterpret_cast<const char*>(&m_SendBuffer[m_SendOffset]), length, 0);
+		if (result == SOCKET_ERROR) {
+			int errorCode = WSAGetLastError();
+			if (errorCode != WSAEWOULDBLOCK) {
+				// Refused: a cluster peer that isn't up yet; the dialer retries quietly
+				if (errorCode != WSAECONNRESET && errorCode != WSAECONNREFUSED) {
+					printf("send failed with error %d\n", errorCode);
+				}
+				Fail();
+			}
+			return;
+		}
+
+		m_SendOffset += result;
+	}
+}
+
+void Session::AttachChannel(std::unique_ptr<SharedMemoryChannel> channel) {
+	// Queued output stays queued and goes through the ring
+	m_Decoder = FrameDecoder();
+	m_Channel = std::move(channel);
+}
+
+void Session::ReadRing() {
+	SharedRing& ring = m_Channel->Inbound();
+	std::vector<char>& recvBuffer = m_Reactor.RecvBuffer();
+	bool armed = false;
+
+	for (;;) {
+		size_t count = ring.Read(recvBuffer.data(), recvBuffer.size());
+		if (count > 0) {
+			m_Decoder.Append(recvBuffer.data(), count);
+			if (ring.TakeWriterWaiting()) {
+				RingDoorbell();
+			}
+			if (m_Decoder.HasFrame()) {
+				return;
+			}
+			continue;
+		}
+
+		// Empty: ask for a doorbell, then look once more for bytes that landed before
+		// the client could see the request
+		if (armed || m_InputClosed) {
+			return;
+		}
+		ring.SetReaderWaiting();
+		armed = true;
+	}
+}
+
+void Session::WriteRing() {
+	SharedRing& ring = m_Channel->Outbound();
+
+	size_t pending = m_SendBuffer.size() - m_SendOffset;
+	if (pending == 0) {
+		m_RingFull = false;
+		return;
+	}
+
+	size_t written = ring.Write(&m_SendBuffer[m_SendOffset], pending);
+	if (written < pending) {
+		// Full: ask for a doorbell once the client has made room, then retry once in case it already has
+		ring.SetWriterWaiting();
+		written += ring.Write(&m_SendBuffer[m_SendOffset + written], pending - written);
+	}
+
+	m_SendOffset += written;
+	m_RingFull = m_SendOffset < m_SendBuffer.size();
+
+	if (written > 0 && ring.TakeReaderWaiting()) {
+		RingDoorbell();
+	}
+
+	// A client that has gone away will never make room
+	if (m_RingFull && m_InputClosed) {
+		Fail();
+	}
+}
+
+void Session::RingDoorbell() {
+	// If the socket buffer is full the client has doorbells pending anyway
+	char doorbell = 1;
+	send(m_Socket, &doorbell, 1, 0);
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <coroutine>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "Reactor.h"
+#include "Message.h"
+#include "FrameDecoder.h"
+#include "TokenBucket.h"
+#include "SharedMemoryChannel.h"
+
+struct ChatRoom;
+
+// One client connection on the reactor.
+// The connection's handler coroutine drives it with co_await ReadFrame() / co_await Write();
+// other connections may append frames with Enqueue() at any time, which never suspends.
+//
+// Input is scheduled deficit round robin: each reactor turn a session may process
+// 'turnQuantum' bytes of frames. Once it is in deficit, ReadFrame() parks the handler
+// until a later turn even if more frames are already buffered, so one flooding client
+// can't hold the loop while everybody else waits.
+class Session : public PollHandler {
+public:
+	Session(Reactor& reactor, SOCKET socket, size_t turnQuantum);
+	~Session();
+
+	Session(const Session&) = delete;
+	Session& operator=(const Session&) = delete;
+
+	// co_await ReadFrame(message): true with the next frame, false once the connection is gone
+	struct ReadAwaiter {
+		Session& session;
+		ChatMessage& message;
+
+		bool await_ready() { return session.TryReadFrame(message); }
+		void await_suspend(std::coroutine_handle<> handle) { session.Suspend(handle, &message); }
+		bool await_resume() const { return !session.m_Closed; }
+	};
+
+	// co_await Write(frame): queues the frame and suspends while the send buffer is over the high-water mark
+	struct WriteAwaiter {
+		Session& session;
+
+		bool await_ready() const { return session.m_Closed || !session.IsBackedUp(); }
+		void await_suspend(std::coroutine_handle<> handle) { session.Suspend(handle, nullptr); }
+		bool await_resume() const { return !session.m_Closed; }
+	};
+
+	// co_await Flush(): suspends until everything queued has been handed to the kernel
+	struct FlushAwaiter {
+		Session& session;
+
+		bool await_ready() const { return session.m_Closed || session.m_SendOffset == session.m_SendBuffer.size(); }
+		void await_suspend(std::coroutine_handle<> handle) { session.m_FlushWaiting = true; session.Suspend(handle, nullptr); }
+		bool await_resume() const { return !session.m_Closed; }
+	};
+
+	ReadAwaiter ReadFrame(ChatMessage& message) { return ReadAwaiter{ *this, message }; }
+	WriteAwaiter Write(const std::vector<uint8_t>& frame) { Enqueue(frame); return WriteAwaiter{ *this }; }
+	FlushAwaiter Flush() { return FlushAwaiter{ *this }; }
+
+	// Queue a frame without suspending. A peer that lets its buffer grow past the
+	// hard limit is a stalled consumer and gets disconnected instead.
+	void Enqueue(const std::vector<uint8_t>& frame);
+
+	// Mark the connection dead and wake its coroutine on the next reactor turn
+	void Fail();
+
+	bool IsClosed() const { return m_Closed; }
+
+	void SetTurnQuantum(size_t turnQuantum) { m_TurnQuantum = turnQuantum; }
+
+	// Carry this connection's frames over 'channel' from now on. Input still buffered from
+	// the socket is discarded; the socket stays open as the doorbell and to detect hang-ups.
+	void AttachChannel(std::unique_ptr<SharedMemoryChannel> channel);
+
+	// PollHandler
+	SOCKET Socket() const override { return m_Socket; }
+	short PollEvents() const override;
+	bool HasDeferredWork() const override { return m_Deferred && !m_Closed; }
+	void OnPollEvents(short revents) override;
+
+	std::string m_Name;
+	std::vector<ChatRoom*> m_Rooms;		// Rooms this connection is a member of
+	uint64_t m_BroadcastEpoch;			// Last broadcast that reached this session, for de-duplication
+
+	TokenBucket m_TextLimit;			// TEXT messages this client may send
+	bool m_Throttled;					// Inside a throttling episode; the client has been told once
+
+private:
+	bool TryReadFrame(ChatMessage& message);
+	void Suspend(std::coroutine_handle<> handle, ChatMessage* readTarget);
+	void ReadSocket();
+	void WriteSocket();
+	void ReadRing();
+	void WriteRing();
+	void RingDoorbell();
+	bool IsBackedUp() const;
+
+	Reactor& m_Reactor;
+	SOCKET m_Socket;
+	bool m_Closed;
+
+	FrameDecoder m_Decoder;
+
+	// Deficit round robin state; may go negative when a frame is larger than what was left
+	int64_t m_Deficit;
+	uint64_t m_DeficitTurn;
+	size_t m_TurnQuantum;
+	bool m_Deferred;					// Frames are buffered but the quantum for this turn is spent
+	bool m_InputClosed;					// Peer sent FIN; buffered frames are still delivered
+
+	std::unique_ptr<SharedMemoryChannel> m_Channel;
+	bool m_RingFull;					// Output is waiting for the client to drain the ring
+
+	std::vector<uint8_t> m_SendBuffer;
+	size_t m_SendOffset;
+
+	// The handler coroutine, while it is suspended in one of the awaiters above
+	std::coroutine_handle<> m_Waiter;
+	ChatMessage* m_ReadTarget;			// Non-null while waiting in ReadFrame
+	bool m_FlushWaiting;
+};
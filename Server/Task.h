@@ -0,0 +1,60 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <stdio.h>
+
+#include "FramePool.h"
+
+// Fire-and-forget coroutine used for connection handlers.
+// It starts running immediately, suspends only at co_await points on the reactor and
+// frees its own frame when it returns. Frames come from FramePool.
+struct DetachedTask {
+	struct promise_type {
+		DetachedTask get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept { }
+
+		void unhandled_exception() noexcept {
+			// Handlers catch their own protocol errors; anything reaching here is a bug.
+			// Log it and let only this connection die instead of the whole server. By now the
+			// handler's locals have been unwound: its ScopeExit guards have taken the session
+			// out of every room and index, so nothing points at the frame about to be freed.
+			try {
+				std::rethrow_exception(std::current_exception());
+			}
+			catch (const std::exception& e) {
+				printf("Connection handler failed: %s\n", e.what());
+			}
+			catch (...) {
+				printf("Connection handler failed with an unknown exception\n");
+			}
+		}
+
+		static void* operator new(size_t size) {
+			return FramePool::Allocate(size);
+		}
+
+		static void operator delete(void* pointer, size_t size) {
+			FramePool::Free(pointer, size);
+		}
+	};
+};
+
+// Runs 'fn' when it goes out of scope: at the end of a handler, at co_return, and when
+// an exception unwinds the handler. Handlers use it to drop every outside reference to
+// their Session before the frame that owns it goes away.
+template <typename Fn>
+class ScopeExit {
+public:
+	explicit ScopeExit(Fn fn) : m_Fn(std::move(fn)) { }
+	~ScopeExit() { m_Fn(); }
+
+	ScopeExit(const ScopeExit&) = delete;
+	ScopeExit& operator=(const ScopeExit&) = delete;
+
+private:
+	Fn m_Fn;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+// Token bucket rate limiter: refills at 'rate' tokens per second and holds at most 'burst'.
+// A bucket with a rate of 0 never limits.
+class TokenBucket {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	TokenBucket()
+		: m_Rate(0)
+		, m_Burst(0)
+		, m_Tokens(0) {
+	}
+
+	void Configure(double rate, double burst, Clock::time_point now) {
+		m_Rate = rate;
+		m_Burst = burst < 1.0 ? 1.0 : burst;
+		m_Tokens = m_Burst;
+		m_LastRefill = now;
+	}
+
+	// Take one token if there is one
+	bool TryConsume(Clock::time_point now) {
+		if (m_Rate <= 0) {
+			return true;
+		}
+
+		double elapsed = std::chrono::duration<double>(now - m_LastRefill).count();
+		if (elapsed > 0) {
+			m_Tokens = (std::min)(m_Burst, m_Tokens + elapsed * m_Rate);
+			m_LastRefill = now;
+		}
+
+		if (m_Tokens < 1.0) {
+			return false;
+		}
+
+		m_Tokens -= 1.0;
+		return true;
+	}
+
+private:
+	double m_Rate;
+	double m_Burst;
+	double m_Tokens;
+	Clock::time_point m_LastRefill;
+};
@@ -1,23 +1,20 @@
-#pragma once
-
 // WinSock2 Windows Sockets
 #define WIN32_LEAN_AND_MEAN
 
 #include <Windows.h>
 #include <WinSock2.h>
 #include <WS2tcpip.h>
+#include <afunix.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
-#include <vector>
-#include <map>
-#include <set>
 
-#include "Buffer.h"
-#include "Message.h"
+#include "Reactor.h"
+#include "ChatServer.h"
 
 // Need to link Ws2_32.lib
 #pragma comment(lib, "Ws2_32.lib")
@@ -30,13 +27,6 @@ WSADATA wsaData;
 struct addrinfo* info = nullptr;
 struct addrinfo hints;
 
-// Define a data structure to represent a room
-struct ChatRoom {
-	std::string roomName; // Room name to represent a room
-	std::vector<SOCKET> clients;  // List of clients in this room
-};
-
-
 // Clean up connections and addr info.
 void cleanUp() {
 	freeaddrinfo(info);
@@ -64,86 +54,207 @@ void handleError(std::string scenario, bool freeMemoryOnError) {
 }
 
 
-// Broadcast message to the other connections in the room, except the sender.
-void BroadcastMessage(const std::string& msg, const std::string& name, MESSAGE_TYPE type, SOCKET senderSocket, const std::map<std::string, ChatRoom>& rooms) {
-	
-	std::set<SOCKET> sentSockets;
+void printUsage() {
+	printf("Usage: Server [options]\n");
+	printf("  --session-rate N    TEXT messages per second per client, 0 = unlimited (default 20)\n");
+	printf("  --session-burst N   messages a client may send back-to-back (default 40)\n");
+	printf("  --room-rate N       TEXT messages per second into one room, 0 = unlimited (default 1000)\n");
+	printf("  --room-burst N      messages a room may take back-to-back (default 2000)\n");
+	printf("  --quantum N         bytes of input per client per loop turn (default 16384)\n");
+	printf("  --presence-window N milliseconds to batch join/leave notices per room, 0 = send each one (default 250)\n");
+	printf("  --max-text N        longest TEXT message in bytes, at most and 0 = 30720 (default 2000)\n");
+	printf("  --max-name N        longest user name in bytes, at most and 0 = 1024 (default 32)\n");
+	printf("  --banned FILE       reject messages and names containing any term in FILE (one per line)\n");
+	printf("  --max-rooms N       rooms one client may be in at once, 0 = unlimited (default 100)\n");
+	printf("  --mailbox N         direct messages kept per offline user, 0 = none (default 100)\n");
+	printf("  --mailboxes N       offline users with a mailbox at once; the oldest give way (default 10000)\n");
+	printf("  --mailbox-bytes N   bytes in all mailboxes together; the oldest give way (default 67108864)\n");
+	printf("  --mailbox-ttl N     seconds an unclaimed mailbox is kept, 0 = no limit (default 86400)\n");
+	printf("  --port PORT         client listen port (default %s)\n", DEFAULT_PORT);
+	printf("  --nodes LIST        cluster link addresses as host:port,host:port,... (same list on every node)\n");
+	printf("  --node-id N         this server's index in --nodes; it accepts other nodes on that entry only\n");
+	printf("  --cluster-key KEY   secret every node must present when linking up (default none)\n");
+	printf("  --unix PATH         also accept clients on this machine over an AF_UNIX socket\n");
+	printf("  --shm               let --unix clients switch to a shared-memory ring\n");
+	printf("  --ring-size N       bytes per direction of each shared-memory ring (default 1048576)\n");
+}
 
-	for (const auto& room : rooms) {
-		for (SOCKET clientSocket : room.second.clients) {
+// Append one term per non-empty line of 'path'. Returns false if it can't be read.
+bool loadBannedTerms(const std::string& path, std::vector<std::string>& terms) {
+	std::ifstream file(path);
+	if (!file) {
+		printf("Could not read banned terms from %s\n", path.c_str());
+		return false;
+	}
 
-			auto it = std::find(room.second.clients.begin(), room.second.clients.end(), senderSocket);
+	std::string line;
+	while (std::getline(file, line)) {
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+		if (!line.empty()) {
+			terms.push_back(line);
+		}
+	}
+	return true;
+}
 
-			if (it == room.second.clients.end()) {
-				// senderSocket is not in this room's clients
-				continue; // Skip broadcasting to this room
-			}
+// Returns false on an unknown option
+bool parseArgs(int argc, char** argv, ServerConfig& config) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
 
-			if (sentSockets.find(clientSocket) != sentSockets.end()) {
-				continue;  // Skip broadcasting to this client
-			}
+		// The only option without a value
+		if (arg == "--shm") {
+			config.sharedMemory = true;
+			continue;
+		}
+
+		if (value == nullptr) {
+			return false;
+		}
 
-			if (clientSocket != senderSocket) {
-				// Create a ChatMessage to send
-				ChatMessage message;
-				message.message = msg;
-				message.from = name;
-				message.messageLength = msg.length();
-				message.nameLength = name.length();
-				message.header.messageType = type;
-				message.header.packetSize = message.message.length()
-					+ sizeof(message.messageLength)
-					+ sizeof(message.header.messageType)
-					+ sizeof(message.from)
-					+ sizeof(message.header.packetSize);
-
-				const int bufSize = 512;
-				Buffer buffer(bufSize);
-
-				// Write our packet to the buffer
-				buffer.WriteUInt32LE(message.header.packetSize);
-				buffer.WriteUInt32LE(message.header.messageType);
-				buffer.WriteUInt32LE(message.messageLength);
-				buffer.WriteUInt32LE(message.nameLength);
-				buffer.WriteString(message.message);
-				buffer.WriteString(message.from);
-
-				// Send the message to the client
-				int result = send(clientSocket, (const char*)(&buffer.m_BufferData[0]), message.header.packetSize, 0);
-				if (result == SOCKET_ERROR) {
-					printf("Failed to broadcast message to client %d\n", WSAGetLastError());
-					return;
-				}
-
-				sentSockets.insert(clientSocket);
+		if (arg == "--session-rate") config.sessionRate = atof(value);
+		else if (arg == "--session-burst") config.sessionBurst = atof(value);
+		else if (arg == "--room-rate") config.roomRate = atof(value);
+		else if (arg == "--room-burst") config.roomBurst = atof(value);
+		else if (arg == "--quantum") config.turnQuantum = atoi(value);
+		else if (arg == "--presence-window") config.presenceWindow = std::chrono::milliseconds(atoi(value));
+		else if (arg == "--max-text") config.maxTextBytes = static_cast<size_t>(atoi(value));
+		else if (arg == "--max-name") config.maxNameBytes = static_cast<size_t>(atoi(value));
+		else if (arg == "--banned") {
+			if (!loadBannedTerms(value, config.bannedTerms)) {
+				return false;
 			}
 		}
+		else if (arg == "--max-rooms") config.maxRooms = static_cast<size_t>(atoi(value));
+		else if (arg == "--mailbox") config.mailboxSize = static_cast<size_t>(atoi(value));
+		else if (arg == "--mailboxes") config.maxMailboxes = static_cast<size_t>(atoi(value));
+		else if (arg == "--mailbox-bytes") config.mailboxBytes = static_cast<size_t>(strtoull(value, nullptr, 10));
+		else if (arg == "--mailbox-ttl") config.mailboxTtl = std::chrono::seconds(atoi(value));
+		else if (arg == "--port") config.port = value;
+		else if (arg == "--node-id") config.nodeId = atoi(value);
+		else if (arg == "--cluster-key") config.clusterKey = value;
+		else if (arg == "--unix") config.localPath = value;
+		else if (arg == "--ring-size") config.ringSize = static_cast<uint32_t>(atoi(value));
+		else if (arg == "--nodes") {
+			std::istringstream ss(value);
+			std::string node;
+			while (std::getline(ss, node, ',')) {
+				config.nodes.push_back(node);
+			}
+		}
+		else return false;
+
+		i++;
+	}
+
+	if (!config.nodes.empty()) {
+		if (config.nodeId < 0 || config.nodeId >= static_cast<int>(config.nodes.size())) {
+			return false;
+		}
+
+		// Cluster links get their own port; a client connection can never become one
+		const std::string& self = config.nodes[config.nodeId];
+		size_t colon = self.rfind(':');
+		if (colon == std::string::npos || self.substr(colon + 1) == config.port) {
+			return false;
+		}
+	}
+
+	if (config.sharedMemory && config.localPath.empty()) {
+		return false;	// Shared memory is only offered to clients that came in over --unix
 	}
+
+	return config.turnQuantum > 0 && config.ringSize > 0 && config.presenceWindow.count() >= 0 && config.mailboxTtl.count() >= 0;
 }
 
+// Create, bind and listen on an AF_UNIX socket at 'path'. Returns INVALID_SOCKET on failure.
+SOCKET listenLocal(const std::string& path) {
+	SOCKADDR_UN address;
+	ZeroMemory(&address, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.length() >= sizeof(address.sun_path)) {
+		printf("Unix socket path is too long: %s\n", path.c_str());
+		return INVALID_SOCKET;
+	}
+	memcpy(address.sun_path, path.c_str(), path.length());
 
-// Create pre-defined rooms for users to enter  
-void createRooms(std::map<std::string, ChatRoom>& rooms) {
-	std::string gameroom = "games";
-	std::string studyroom = "study";
-	std::string newsroom = "news";
+	SOCKET localSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (localSocket == INVALID_SOCKET) {
+		printf("Unix socket failed with error %d\n", WSAGetLastError());
+		return INVALID_SOCKET;
+	}
 
-	ChatRoom room1;
-	room1.roomName = gameroom;
+	// A previous run may have left the socket file behind
+	DeleteFileA(path.c_str());
 
-	ChatRoom room2;
-	room2.roomName = studyroom;
+	if (bind(localSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR) {
+		printf("Unix socket bind failed - Error %d\n", WSAGetLastError());
+		closesocket(localSocket);
+		return INVALID_SOCKET;
+	}
 
-	ChatRoom room3;
-	room3.roomName = newsroom;
+	if (listen(localSocket, SOMAXCONN) == SOCKET_ERROR) {
+		printf("Unix socket listen failed - Error %d\n", WSAGetLastError());
+		closesocket(localSocket);
+		return INVALID_SOCKET;
+	}
 
-	rooms[gameroom] = room1;
-	rooms[studyroom] = room2;
-	rooms[newsroom] = room3;
+	return localSocket;
+}
+
+// Create, bind and listen on this node's "host:port" entry in --nodes, for links from
+// the other nodes only. Returns INVALID_SOCKET on failure.
+SOCKET listenCluster(const std::string& endpoint) {
+	size_t colon = endpoint.rfind(':');
+	std::string host = endpoint.substr(0, colon);
+	std::string port = endpoint.substr(colon + 1);
+
+	struct addrinfo clusterHints;
+	ZeroMemory(&clusterHints, sizeof(clusterHints));
+	clusterHints.ai_family = AF_INET;
+	clusterHints.ai_socktype = SOCK_STREAM;
+	clusterHints.ai_protocol = IPPROTO_TCP;
+	clusterHints.ai_flags = AI_PASSIVE;
+
+	struct addrinfo* clusterInfo = nullptr;
+	if (getaddrinfo(host.c_str(), port.c_str(), &clusterHints, &clusterInfo) != 0 || clusterInfo == nullptr) {
+		printf("Could not resolve cluster address %s\n", endpoint.c_str());
+		return INVALID_SOCKET;
+	}
+
+	SOCKET clusterSocket = socket(clusterInfo->ai_family, clusterInfo->ai_socktype, clusterInfo->ai_protocol);
+	if (clusterSocket == INVALID_SOCKET) {
+		printf("Cluster socket failed with error %d\n", WSAGetLastError());
+		freeaddrinfo(clusterInfo);
+		return INVALID_SOCKET;
+	}
+
+	if (bind(clusterSocket, clusterInfo->ai_addr, (int)clusterInfo->ai_addrlen) == SOCKET_ERROR) {
+		printf("Cluster bind failed - Error %d\n", WSAGetLastError());
+		closesocket(clusterSocket);
+		freeaddrinfo(clusterInfo);
+		return INVALID_SOCKET;
+	}
+	freeaddrinfo(clusterInfo);
 
-	printf("%s .... Room Created\n", gameroom.c_str());
-	printf("%s .... Room Created\n", studyroom.c_str());
-	printf("%s .... Room Created\n", newsroom.c_str());
+	if (listen(clusterSocket, SOMAXCONN) == SOCKET_ERROR) {
+		printf("Cluster listen failed - Error %d\n", WSAGetLastError());
+		closesocket(clusterSocket);
+		return INVALID_SOCKET;
+	}
+
+	return clusterSocket;
+}
+
+// Close the AF_UNIX listen socket, if any, and remove its file
+void closeLocal(SOCKET localSocket, const std::string& path) {
+	if (localSocket != INVALID_SOCKET) {
+		closesocket(localSocket);
+		DeleteFileA(path.c_str());
+	}
 }
 
 
@@ -154,7 +265,14 @@ void printLine() {
 
 
 // Server code execution begins
-int main(int arg, char** argv) {
+int main(int argc, char** argv) {
+	ServerConfig config;
+	config.port = DEFAULT_PORT;
+	if (!parseArgs(argc, argv, config)) {
+		printUsage();
+		return 1;
+	}
+
 	printf("Initializing Server...\n\n");
 
 	// Initialize WinSock
@@ -175,7 +293,7 @@ int main(int arg, char** argv) {
 	hints.ai_protocol = IPPROTO_TCP;	// TCP
 	hints.ai_flags = AI_PASSIVE;
 
-	result = getaddrinfo(NULL, DEFAULT_PORT, &hints, &info);
+	result = getaddrinfo(NULL, config.port.c_str(), &hints, &info);
 	if (result != 0) {
 		handleError("GetAddrInfo", true);
 		return 1;
@@ -212,263 +330,61 @@ int main(int arg, char** argv) {
 	}
 	printf("Listening to socket  --->  Success!\n");
 
+	SOCKET localSocket = INVALID_SOCKET;
+	if (!config.localPath.empty()) {
+		localSocket = listenLocal(config.localPath);
+		if (localSocket == INVALID_SOCKET) {
+			closesocket(listenSocket);
+			cleanUp();
+			return 1;
+		}
+		printf("Listening on %s  --->  Success!%s\n", config.localPath.c_str(), config.sharedMemory ? " (shared memory)" : "");
+	}
 
 	// Creating rooms
 	printLine();
 	printf("\nCreating rooms... \n");
 
-	std::map<std::string, ChatRoom> rooms;
-	createRooms(rooms);
+	// Every connection runs as a coroutine on this one reactor; there is no
+	// per-connection thread and no FD_SETSIZE limit on how many can be open.
+	Reactor reactor;
+	ChatServer server(reactor, listenSocket, config);
+	if (localSocket != INVALID_SOCKET) {
+		server.ListenLocal(localSocket);
+	}
+	server.CreateRooms();
 	printLine();
 
+	SOCKET clusterSocket = INVALID_SOCKET;
+	if (config.nodes.size() > 1) {
+		clusterSocket = listenCluster(config.nodes[config.nodeId]);
+	}
 
-	// Initialize active sockets and sockets ready for reading
-	FD_SET activeSockets;
-	FD_SET socketsReadyForReading;
-
-	FD_ZERO(&activeSockets);
-	FD_ZERO(&socketsReadyForReading);
-
-	// Use a timeval to prevent select from waiting forever.
-	timeval tv;
-	tv.tv_sec = 1;
-	tv.tv_usec = 0;
-
-	while (true)
-	{
-		// Reset the socketsReadyForReading
-		FD_ZERO(&socketsReadyForReading);
-		FD_SET(listenSocket, &socketsReadyForReading);
-
-		for (const auto& room : rooms) {
-			for (int i = 0; i < room.second.clients.size(); i++) {
-				FD_SET(room.second.clients[i], &socketsReadyForReading);
-			}
-		}
-
-		int count = select(0, &socketsReadyForReading, NULL, NULL, &tv);
-		if (count == 0) {
-			continue;
-		}
-
-		if (count == SOCKET_ERROR) {
-			handleError("Socket Select", false);
-			continue;
-		}
-
-		for (auto& room : rooms) {
-
-			for (int i = 0; i < room.second.clients.size(); i++) {
-
-				SOCKET socket = room.second.clients[i];
-
-				if (FD_ISSET(socket, &socketsReadyForReading))
-				{
-					const int bufSize = 512;
-					Buffer buffer(bufSize);
-
-					// Socket recv result checks
-					// -1 : SOCKET_ERROR -- Get more info received from WSAGetLastError() after 
-					//  0 : Client disconnected
-					// >0 : The number of bytes received.
-					int result = recv(socket, (char*)(&buffer.m_BufferData[0]), bufSize, 0);
-					if (result == SOCKET_ERROR) {
-						printf("11 recv failed with error %d\n", WSAGetLastError());
-
-						auto it = std::find(room.second.clients.begin(), room.second.clients.end(), socket);
-
-						// Check if the socket was found and then erase it
-						if (it != room.second.clients.end()) {
-							room.second.clients.erase(it);
-						}
-
-						FD_CLR(socket, &activeSockets);
-						continue;
-					}
-
-					if (result == 0) {
-						// Remove the disconnected client from the list
-						closesocket(socket);
-
-						FD_CLR(socket, &activeSockets);
-
-						auto& clients = room.second.clients;
-
-						// Find the iterator for the socket you want to remove
-						auto it = std::find(room.second.clients.begin(), room.second.clients.end(), socket);
-
-						// Check if the socket was found and then erase it
-						if (it != room.second.clients.end()) {
-							room.second.clients.erase(it);
-						}
-
-						closesocket(socket);
-
-						i--; // Decrement the index since we removed an element
-
-						continue;
-					}
-
-					if (result > 0) {
-						// Get the data from buffer.
-						uint32_t packetSize = buffer.ReadUInt32LE();
-						uint32_t messageType = buffer.ReadUInt32LE();
-
-						// Check data based on message type.
-						if (messageType == NOTIFICATION) {
-							uint32_t messageLength = buffer.ReadUInt32LE();
-							uint32_t nameLength = buffer.ReadUInt32LE();
-
-							std::string msg = buffer.ReadString(messageLength);
-
-							printf(msg.c_str());
-							printf("\n");
-						}
-						else if (messageType == TEXT) {
-							// We know this is a ChatMessage
-							uint32_t messageLength = buffer.ReadUInt32LE();
-							uint32_t nameLength = buffer.ReadUInt32LE();
-							std::string msg = buffer.ReadString(messageLength);
-							std::string name = buffer.ReadString(nameLength);
-
-							BroadcastMessage(msg, name, TEXT, socket, rooms);
-						}
-						else if (messageType == LEAVE_ROOM) {
-							uint32_t messageLength = buffer.ReadUInt32LE();
-							uint32_t nameLength = buffer.ReadUInt32LE();
-							std::string roomName = buffer.ReadString(messageLength);
-							std::string name = buffer.ReadString(nameLength);
-
-							bool socketFoundInAnyRoom = false;
-
-							// Broadcast a leave message to other clients in the room
-							std::string leaveMessage = name + " has left the room.\n";
-							printf(leaveMessage.c_str());
-
-							BroadcastMessage(leaveMessage, name, NOTIFICATION, socket, rooms);
-
-							// Iterate through all rooms in rooms
-							for (auto& roomPair : rooms) {
-								ChatRoom& chatroom = roomPair.second;
-								// Check if the current room matches the roomName
-								if (roomPair.first == roomName) {
-									auto it = std::find(chatroom.clients.begin(), chatroom.clients.end(), socket);
-
-									if (it != chatroom.clients.end()) {
-										// Remove the socket from the current room
-										chatroom.clients.erase(it);
-										// Set a flag to indicate that the socket was found in the current room
-										socketFoundInAnyRoom = true;
-									}
-								}
-							}
-
-							if (!socketFoundInAnyRoom) {
-								// If the socket was not found in any room, close and clear it
-								FD_CLR(socket, &socketsReadyForReading);
-								closesocket(socket);  // Close the client socket
-							}
-						}
-					}
-				}
-			}
+	if (!server.StartCluster() || (config.nodes.size() > 1 && clusterSocket == INVALID_SOCKET)) {
+		closesocket(listenSocket);
+		if (clusterSocket != INVALID_SOCKET) {
+			closesocket(clusterSocket);
 		}
+		closeLocal(localSocket, config.localPath);
+		cleanUp();
+		return 1;
+	}
 
-		if (count > 0) {
-
-			if (FD_ISSET(listenSocket, &socketsReadyForReading)) {
-
-				SOCKET newConnection = accept(listenSocket, NULL, NULL);
-
-				if (newConnection == INVALID_SOCKET) {
-
-					printf("accept failed with error: %d\n", WSAGetLastError());
-
-				} else {
-
-					std::string roomChoice;
-					std::string selectedRoom;
-
-					const int bufSize = 512;
-					Buffer buffer(bufSize);
-
-					int result = recv(newConnection, (char*)(&buffer.m_BufferData[0]), bufSize, 0);
-					if (result == SOCKET_ERROR) {
-						int errorCode = WSAGetLastError();
-						if (errorCode == WSANOTINITIALISED) {
-
-						}
-						else if (errorCode == WSAEWOULDBLOCK) {
-
-						}
-						else {
-							printf("recv failed with error %d\n", WSAGetLastError());
-							closesocket(listenSocket);
-							freeaddrinfo(info);
-							WSACleanup();
-							break;
-						}
-					}
-					else {
-
-						uint32_t packetSize = buffer.ReadUInt32LE();
-						uint32_t messageType = buffer.ReadUInt32LE();
-
-						if (messageType == JOIN_ROOM) {
-							uint32_t messageLength = buffer.ReadUInt32LE();
-							uint32_t nameLength = buffer.ReadUInt32LE();
-							std::string msg = buffer.ReadString(messageLength);
-							std::string name = buffer.ReadString(nameLength);
-
-							selectedRoom = msg;
-
-							std::string joinMessage = name + " has joined the room.\n";
-
-							printf("%s has joined the room.\n", name.c_str());
-
-							// Split selectedRoom into individual room names based on commas
-							std::vector<std::string> roomNames;
-							std::string roomName;
-
-							std::istringstream ss(selectedRoom);
-
-							while (std::getline(ss, name, ',')) {
-								roomNames.push_back(name);
-							}
-
-							// Add the new connection to each room
-							for (const std::string& room : roomNames) {
-								if (rooms.find(room) != rooms.end()) {
-									rooms[room].clients.push_back(newConnection);
-								}
-								else {
-									// Room doesn't exist, create a new room
-									ChatRoom newRoom;
-									newRoom.roomName = room;
-									rooms[room] = newRoom;
-									rooms[room].clients.push_back(newConnection);
-								}
-							}
-
-
-							BroadcastMessage(joinMessage, name, NOTIFICATION, newConnection, rooms);
-						}
-					}
-
-					//activeConnections.push_back(newConnection);
-					FD_SET(newConnection, &activeSockets);
-					FD_CLR(listenSocket, &socketsReadyForReading);
-
-					printf("Client connected with Socket: %d\n", (int) newConnection);
-				}
-			}
-		}
+	if (clusterSocket != INVALID_SOCKET) {
+		server.ListenCluster(clusterSocket);
+		printf("Cluster links on %s  --->  Success!\n", config.nodes[config.nodeId].c_str());
 	}
 
+	reactor.Run();
+
 	system("Pause");
 
 	// Cleanup resources and close socket connection.
 	closesocket(listenSocket);
+	if (clusterSocket != INVALID_SOCKET) {
+		closesocket(clusterSocket);
+	}
+	closeLocal(localSocket, config.localPath);
 	cleanUp();
 
 	return 0;